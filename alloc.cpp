@@ -0,0 +1,79 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+// Replacements of the global operator new that count the bytes requested for the profiler.
+// Only the program links them in, so tests and benchmarks are free to replace operator new.
+
+
+void* operator new(size_t size) {
+    countAllocation(size);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+
+// Over-aligned allocations, eg. scratch arena blocks
+void* operator new(size_t size, std::align_val_t alignment) {
+    countAllocation(size);
+    // aligned_alloc needs a multiple of the alignment
+    size_t align = static_cast<size_t>(alignment);
+    if (void* ptr = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
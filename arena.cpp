@@ -0,0 +1,76 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <new>
+
+
+ScratchArena::~ScratchArena() {
+    releaseBlocks();
+}
+
+
+ScratchArena::Scope::Scope(ScratchArena& arena)
+    : arena(arena), block(arena.current), used(arena.used), live(arena.live) {}
+
+
+ScratchArena::Scope::~Scope() {
+    arena.current = block;
+    arena.used = used;
+    arena.live = live;
+
+    // A call that needed more than one block gets the high-water mark in one block next time
+    if (live == 0 && arena.blocks.size() > 1) {
+        arena.releaseBlocks();
+    }
+}
+
+
+size_t ScratchArena::capacity() const {
+    size_t total = 0;
+    for (const Block& block : blocks) {
+        total += block.size;
+    }
+    return total;
+}
+
+
+void* ScratchArena::allocateBytes(size_t bytes) {
+    if (bytes == 0) return nullptr;
+    const size_t size = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    // Blocks after the current one are empty, so the first that fits is used
+    while (blocks.empty() || used + size > blocks[current].size) {
+        if (current + 1 < blocks.size()) {
+            current++;
+            used = 0;
+        } else {
+            // Grows geometrically, and straight to the high-water mark after a merge
+            addBlock(std::max({size, peak, capacity()}));
+        }
+    }
+
+    void* ptr = blocks[current].data + used;
+    used += size;
+    live += size;
+    peak = std::max(peak, live);
+    return ptr;
+}
+
+
+void ScratchArena::addBlock(size_t size) {
+    std::byte* data = static_cast<std::byte*>(::operator new(size, std::align_val_t(ALIGNMENT)));
+    blocks.push_back({data, size});
+    allocations++;
+    current = blocks.size() - 1;
+    used = 0;
+}
+
+
+void ScratchArena::releaseBlocks() {
+    for (const Block& block : blocks) {
+        ::operator delete(block.data, std::align_val_t(ALIGNMENT));
+    }
+    blocks.clear();
+    current = 0;
+    used = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+
+/// @brief Bump allocator for the working memory of DSP functions. Buffers are 64-byte
+/// aligned and handed out from a few large blocks, then given back all at once when the
+/// Scope they were allocated in ends. Once every scope has ended, blocks added to fit a
+/// larger call are merged into one block of the high-water mark, so running the same
+/// command again allocates nothing and touches pages that are already mapped.
+/// Not thread-safe: buffers for parallel tasks are allocated before dispatching them.
+class ScratchArena {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    ScratchArena() = default;
+    ~ScratchArena();
+
+    // Scratch holds no state, so a copy starts empty
+    ScratchArena(const ScratchArena&) {}
+    ScratchArena& operator=(const ScratchArena&) { return *this; }
+
+    /// @brief Gives back everything allocated from the arena during its lifetime. Scopes nest.
+    class Scope {
+    public:
+        explicit Scope(ScratchArena& arena);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ScratchArena& arena;
+        size_t block;
+        size_t used;
+        size_t live;
+    };
+
+    /// @brief Uninitialised buffer, valid until the innermost enclosing Scope ends
+    /// @param count number of elements
+    template <typename T>
+    std::span<T> allocate(size_t count) {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+                      "Scratch buffers are never constructed or destroyed");
+        static_assert(alignof(T) <= ALIGNMENT);
+        return std::span<T>(static_cast<T*>(allocateBytes(count * sizeof(T))), count);
+    }
+
+    /// @brief Most bytes in use at once, including alignment padding
+    size_t highWaterMark() const { return peak; }
+
+    /// @brief Bytes held in blocks
+    size_t capacity() const;
+
+    /// @brief Number of blocks requested from the heap so far
+    size_t blockAllocations() const { return allocations; }
+
+private:
+    struct Block {
+        std::byte* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0;             // Block allocations are bumped from
+    size_t used = 0;                // Bytes used in the current block
+    size_t live = 0;                // Bytes used over all blocks
+    size_t peak = 0;
+    size_t allocations = 0;
+
+    void* allocateBytes(size_t bytes);
+    void addBlock(size_t size);
+    void releaseBlocks();
+};
+
+#endif
@@ -1,86 +1,486 @@
 #include "audio.h"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <tuple>
+
+#include "dsp.h"
+#include "mapped.h"
+
+// Frames every deferred operation runs on before the next one, so they stay in cache
+static constexpr size_t FUSED_BLOCK = 4096;
+
+// Trimmed samples are released once the storage is this many times the view
+static constexpr size_t COMPACT_RATIO = 4;
+
+// Frames load converts per task
+static constexpr size_t LOAD_BLOCK = 1 << 16;
+
+// Frames save converts and writes at a time, large enough that each write is one system
+// call of 128 KB for stereo and small enough to stay in cache
+static constexpr size_t WRITE_BLOCK = 1 << 15;
+
+// Frames writeOutputTxt formats per task
+static constexpr size_t TEXT_CHUNK = 1 << 15;
+
+// Longest text line is a time of "18446744073709.551615," then a "-32768" and a separator or
+// newline per channel. The last sample of a chunk writes up to 8 bytes past its text.
+static constexpr size_t MAX_TIME_CHARS = 22;
+static constexpr size_t MAX_SAMPLE_CHARS = 7;
+static constexpr size_t TEXT_SLACK = 8;
+
+static bool deferred = false;
+
+// Samples saturated by floatToPcm16, encodeSamples and interleaveSamples since the program started, from any thread
+static std::atomic<size_t> clipped{0};
+
+bool parseChannelMask(const std::string& text, ChannelMask& mask) {
+    std::string word(text);
+    std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (word == "l" || word == "left") {
+        mask = LEFT_CHANNEL;
+        return true;
+    }
+    if (word == "r" || word == "right") {
+        mask = RIGHT_CHANNEL;
+        return true;
+    }
+    if (word == "b" || word == "both") {
+        mask = ALL_CHANNELS;
+        return true;
+    }
+
+    mask = 0;
+    const char* position = text.data();
+    const char* end = position + text.size();
+    bool valid = !text.empty();
+    while (valid && position < end) {
+        size_t channel;
+        auto [next, error] = std::from_chars(position, end, channel);
+        valid = error == std::errc() && channel < MAX_CHANNELS && (next == end || (*next == ',' && next + 1 != end));
+        if (valid) mask |= ChannelMask(1) << channel;
+        position = next + 1;
+    }
+
+    if (!valid) {
+        std::cerr << "Error: Invalid channel selection (l, r, b or channel numbers, eg. 0,2) \n\n";
+    }
+    return valid;
+}
+
+
+ChannelMask selectChannels(ChannelMask sel, size_t numChannels) {
+    if (numChannels == 0) {
+        std::cerr << "Error: No audio data\n\n";
+        return 0;
+    }
+
+    const ChannelMask present = numChannels >= MAX_CHANNELS ? ALL_CHANNELS : (ChannelMask(1) << numChannels) - 1;
+    if (sel == ALL_CHANNELS) {
+        return present;
+    }
+
+    if (sel & ~present) {
+        if (numChannels == 1 && sel == RIGHT_CHANNEL) {
+            std::cerr << "Audio is mono and does not have a right channel" << "\n\n";
+        } else {
+            std::cerr << "Error: Audio has " << numChannels << " channels, numbered from 0\n\n";
+        }
+        return 0;
+    }
+    return sel;
+}
+
+
+std::string describeChannels(ChannelMask selected, size_t numChannels) {
+    if (numChannels <= 2) {
+        return selected == LEFT_CHANNEL ? "left channel" : selected == RIGHT_CHANNEL ? "right channel" : "left and right channels";
+    }
+
+    std::vector<size_t> numbers;
+    for (size_t c = 0; c < numChannels; c++) {
+        if (selected >> c & 1) numbers.push_back(c);
+    }
+
+    if (numbers.size() == numChannels) {
+        return "all " + std::to_string(numChannels) + " channels";
+    }
+
+    std::string text = numbers.size() == 1 ? "channel " : "channels ";
+    for (size_t i = 0; i < numbers.size(); i++) {
+        text += (i == 0 ? "" : i + 1 == numbers.size() ? " and " : ", ") + std::to_string(numbers[i]);
+    }
+    return text;
+}
+
+
 AudioProcessor::AudioProcessor(const std::string& inputFile) {
     initialise(inputFile);
 }
 
 void AudioProcessor::initialise(const std::string& inputFile) {
-    // Open input file in binary mode
-    std::ifstream inFile(inputFile, std::ios::binary);
-    if (!inFile) {
-        throw std::runtime_error("Unable to open file: " + inputFile + "\n");
+    load(inputFile);
+
+    std::cout << "Sucessfully read from " << inputFile << "\n\n";
+}
+
+// Input stream over bytes in memory, so headers parse in place and skipped chunks cost nothing
+struct MemoryBuffer : std::streambuf {
+    MemoryBuffer(const char* data, size_t size) {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
     }
 
-    // Read WAV header
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(WavHeader));
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+        char* base = dir == std::ios_base::beg ? eback() : dir == std::ios_base::cur ? gptr() : egptr();
+        if (offset < eback() - base || offset > egptr() - base) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), base + offset, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode mode) override {
+        return seekoff(off_type(position), std::ios_base::beg, mode);
+    }
+};
+
+
+void AudioProcessor::load(const std::string& inputFile) {
+    MappedFile file(inputFile);
+
+    // WAV header, LIST chunk and data chunk header, parsed from the mapping
+    MemoryBuffer buffer(file.data(), file.size());
+    std::istream inFile(&buffer);
+    uint64_t dataSize = readWavHeader(inFile, header, listData);
+    const size_t position = inFile.tellg();
+    const char* data = file.data() + position;
+
+    // A truncated file keeps the frames it has
+    const PcmCodec& codec = *findPcmCodec(header.audioFormat, header.bitsPerSample);
+    const size_t numChannels = header.numChannels;
+    const size_t available = std::min<size_t>(dataSize, file.size() - position);
+    const size_t numChannelSamples = available / (numChannels * codec.bytes);
+
+    // Straight from the mapping into the channels, converting once to float. The input may
+    // be unaligned, eg. after an odd sized LIST chunk.
+    channels.assign(numChannels, std::vector<float>(numChannelSamples));
+
+    // Blocks fault their pages in on every thread at once
+    const size_t blocks = (numChannelSamples + LOAD_BLOCK - 1) / LOAD_BLOCK;
+    ThreadPool::global().parallelFor(blocks, [&](size_t b) {
+        size_t start = b * LOAD_BLOCK;
+        size_t count = std::min(LOAD_BLOCK, numChannelSamples - start);
+        float* outputs[MAX_CHANNELS];
+        for (size_t c = 0; c < numChannels; c++) {
+            outputs[c] = channels[c].data() + start;
+        }
+        codec.deinterleave(data + start * numChannels * codec.bytes, count, numChannels, outputs);
+    });
+
+
+    totalDuration = static_cast<float>(numChannelSamples) / header.sampleRate;
+
+
+    equaliserBands = designBands(EQUALISER_LAYOUT, header.sampleRate);
+
+    pending.clear();
+    resetView();
+}
+
+
+void AudioProcessor::setDeferred(bool enabled) {
+    deferred = enabled;
+}
 
-    if (!validWavFile()) {
-        throw std::runtime_error("Invalid WAV file: " + inputFile + "\n");
-    }    
 
-    // Read LIST chunk ID and size
-    if (strncmp(header.subchunk2ID, "LIST", 4) == 0 && header.subchunk2Size > 0) {
-        listData.resize(header.subchunk2Size);
-        if (!inFile.read(listData.data(), header.subchunk2Size)) {
-            throw std::runtime_error("Failed to read LIST chunk\n");
+bool AudioProcessor::getDeferred() {
+    return deferred;
+}
+
+
+size_t AudioProcessor::getClippedSamples() {
+    return clipped.load(std::memory_order_relaxed);
+}
+
+
+void AudioProcessor::evaluate() {
+    // Operations on samples outside the view are never needed
+    runPending(viewOffset, viewOffset + viewLength);
+    pending.clear();
+
+    // One copy of the view, releasing the trimmed storage
+    if (viewOffset != 0 || viewLength != storedFrames()) {
+        for (std::vector<float>& channel : channels) {
+            auto first = channel.begin() + viewOffset;
+            channel = std::vector<float>(first, first + viewLength);
         }
     }
 
-    // Read data chunk ID and size
-    char chunkID[5] = {0};  // +1 for null terminator
-    u_int32_t dataSize;
-    if (!inFile.read(chunkID, 4) || 
-        !inFile.read(reinterpret_cast<char*>(&dataSize), 4) || 
-        strcmp(chunkID, "data") != 0) {
-        throw std::runtime_error("Failed to read data chunk\n");
+    if (viewReversed) {
+        for (std::vector<float>& channel : channels) {
+            std::reverse(channel.begin(), channel.end());
+        }
     }
 
-    // Read data    
-    std::vector<uint8_t> rawData(dataSize);
-    inFile.read(reinterpret_cast<char*>(rawData.data()), dataSize);
-    inFile.close();
+    resetView();
+}
+
 
+std::pair<size_t, size_t> AudioProcessor::storedRange(size_t startIndex, size_t endIndex) const {
+    endIndex = std::min(endIndex, viewLength);
+    startIndex = std::min(startIndex, endIndex);
 
-    // Separate channels
-    leftChannel.clear();
-    rightChannel.clear();
+    size_t begin = viewReversed ? viewOffset + viewLength - endIndex : viewOffset + startIndex;
+    return {begin, begin + (endIndex - startIndex)};
+}
 
-    auto *samples = reinterpret_cast<int16_t *>(rawData.data());
-    size_t numSamples = rawData.size() / sizeof(int16_t);
-    size_t numChannelSamples = numSamples / header.numChannels;
-    
-    for (size_t i = 0; i < numChannelSamples; i++) {
-        leftChannel.push_back(samples[i * header.numChannels]);
-        if (header.numChannels == 2) {
-            rightChannel.push_back(samples[i * header.numChannels + 1]);
+
+void AudioProcessor::defer(PendingOp op, size_t startIndex, size_t endIndex) {
+    std::tie(op.begin, op.end) = storedRange(startIndex, endIndex);
+    pending.push_back(op);
+}
+
+
+void AudioProcessor::runPending(size_t begin, size_t end) {
+    if (pending.empty()) return;
+
+    // Every operation runs on a block before the next block is loaded, keeping
+    // the order of the operations for each sample
+    for (size_t blockStart = begin; blockStart < end; blockStart += FUSED_BLOCK) {
+        size_t blockEnd = std::min(blockStart + FUSED_BLOCK, end);
+
+        for (const PendingOp& op : pending) {
+            size_t first = std::max(op.begin, blockStart);
+            size_t last = std::min(op.end, blockEnd);
+            if (first >= last) continue;
+
+            for (size_t c = 0; c < channels.size(); c++) {
+                if (!(op.channels >> c & 1)) continue;
+
+                std::span<float> samples = std::span(channels[c]).subspan(first, last - first);
+                if (op.type == PendingOp::Type::Gain) {
+                    scaleSamples(samples, op.gain);
+                } else {
+                    compressSamples(samples, op.threshold, op.ratio, op.makeUpGain);
+                }
+            }
         }
     }
+}
 
 
-    totalDuration = static_cast<float>(leftChannel.size()) / header.sampleRate;
+void AudioProcessor::renderFrames(size_t start, size_t count, float* output) {
+    size_t begin = viewReversed ? viewOffset + viewLength - start - count : viewOffset + start;
+    runPending(begin, begin + count);
 
+    const size_t numChannels = channels.size();
+    for (size_t c = 0; c < numChannels; c++) {
+        const float* channel = channels[c].data();
+        for (size_t i = 0; i < count; i++) {
+            size_t j = viewReversed ? begin + count - 1 - i : begin + i;
+            output[i * numChannels + c] = channel[j];
+        }
+    }
+}
 
-    // Sub-Bass, Bass, Midrange, Upper Midrange, Treble
-    // 55, 182, 606, 2007, 6654, 22050 at 44.1kHz sampling
-    // 20, 66, 220, 728, 2414, 8000 at 16kHz sampling
-    b = {
-        {0.01375,0.01375}, // 1st LPF
-        {0.033049,0,-0.033049}, // 1st BPF
-        {0.1071,0,-0.1071}, // 1st BPF
-        {0.088671,0,-0.17734,0,0.088671}, // 2nd BPF
-        {0.55023,-1.1005,0.55023} // 2nd HPF
-    };
 
-    a = {
-        {1,-0.9725}, 
-        {1,-1.932,0.9339}, 
-        {1,-1.7675,0.78579}, 
-        {1,-2.6243,2.8009,-1.4938,0.35398}, 
-        {1,-0.88674,0.31417}
+void AudioProcessor::resetView() {
+    viewOffset = 0;
+    viewLength = storedFrames();
+    viewReversed = false;
+}
 
-    };
 
-    std::cout << "Sucessfully read from " << inputFile << "\n\n";
+std::vector<float*> AudioProcessor::channelData(ChannelMask selected) {
+    std::vector<float*> data;
+    for (size_t c = 0; c < channels.size(); c++) {
+        if (selected >> c & 1) {
+            data.push_back(channels[c].data());
+        }
+    }
+    return data;
+}
+
+
+// Reads the id and size of the next chunk, false at the end of the file
+static bool readChunkHeader(std::istream& inFile, char id[4], uint32_t& size) {
+    return static_cast<bool>(inFile.read(id, 4)) && static_cast<bool>(inFile.read(reinterpret_cast<char*>(&size), 4));
+}
+
+
+// Moves past the rest of a chunk and its pad byte without reading them
+static void skipChunk(std::istream& inFile, uint64_t remaining, uint32_t size) {
+    inFile.seekg(remaining + (size & 1), std::ios::cur);
+}
+
+
+uint64_t AudioProcessor::readWavHeader(std::istream& inFile, WavHeader& header, std::vector<char>& listData) {
+    header = WavHeader();
+    listData.clear();
+
+    // RIFF, or RF64/BW64 whose sizes over 4 GB are in the ds64 chunk
+    inFile.read(header.chunkID, 4);
+    inFile.read(reinterpret_cast<char*>(&header.chunkSize), 4);
+    inFile.read(header.format, 4);
+    if (!inFile) {
+        throw std::runtime_error("Invalid WAV file\n");
+    }
+    const bool rf64 = strncmp(header.chunkID, "RF64", 4) == 0 || strncmp(header.chunkID, "BW64", 4) == 0;
+
+    uint64_t ds64DataSize = 0;
+    bool haveFmt = false;
+    char id[4];
+    uint32_t size;
+
+    // Chunks come in any order up to the data chunk, the ones not needed are seeked over
+    while (readChunkHeader(inFile, id, size)) {
+        if (strncmp(id, "ds64", 4) == 0 && size >= 3 * sizeof(uint64_t)) {
+            uint64_t riffSize, sampleCount;
+            inFile.read(reinterpret_cast<char*>(&riffSize), sizeof(riffSize));
+            inFile.read(reinterpret_cast<char*>(&ds64DataSize), sizeof(ds64DataSize));
+            inFile.read(reinterpret_cast<char*>(&sampleCount), sizeof(sampleCount));
+            skipChunk(inFile, size - 3 * sizeof(uint64_t), size);
+        } else if (strncmp(id, "fmt ", 4) == 0 && size >= 16) {
+            std::memcpy(header.subchunk1ID, id, 4);
+            header.subchunk1Size = size;
+            inFile.read(reinterpret_cast<char*>(&header.audioFormat), 16);
+            uint64_t remaining = size - 16;
+
+            // WAVE_FORMAT_EXTENSIBLE names the real format in the first two bytes of its
+            // subformat GUID, after the extension size, valid bits and channel mask
+            if (header.audioFormat == WAVE_FORMAT_EXTENSIBLE && size >= 40) {
+                inFile.seekg(4, std::ios::cur);
+                inFile.read(reinterpret_cast<char*>(&header.channelMask), 4);
+                inFile.read(reinterpret_cast<char*>(&header.audioFormat), 2);
+                remaining -= 10;
+            }
+            skipChunk(inFile, remaining, size);
+            haveFmt = true;
+        } else if (strncmp(id, "LIST", 4) == 0) {
+            std::memcpy(header.subchunk2ID, id, 4);
+            header.subchunk2Size = size;
+            listData.resize(size);
+            if (!inFile.read(listData.data(), size)) {
+                throw std::runtime_error("Failed to read LIST chunk\n");
+            }
+            skipChunk(inFile, 0, size);
+        } else if (strncmp(id, "data", 4) == 0) {
+            if (!haveFmt || !validWavHeader(header)) {
+                throw std::runtime_error("Invalid WAV file\n");
+            }
+            // Without a LIST chunk the header shows the data chunk in its place
+            if (strncmp(header.subchunk2ID, "LIST", 4) != 0) {
+                std::memcpy(header.subchunk2ID, id, 4);
+                header.subchunk2Size = size;
+            }
+            return rf64 && size == UINT32_MAX ? ds64DataSize : size;
+        } else {
+            skipChunk(inFile, size, size);
+        }
+
+        if (!inFile) {
+            break;
+        }
+    }
+
+    if (!haveFmt) {
+        throw std::runtime_error("Invalid WAV file\n");
+    }
+    throw std::runtime_error("Failed to read data chunk\n");
+}
+
+
+void AudioProcessor::writeWavHeader(std::ostream& outFile, const WavHeader& header, uint64_t dataSize) {
+    // Players expect the extensible format for more than 2 channels
+    const bool extensible = header.numChannels > 2 || header.channelMask != 0;
+    const uint32_t fmtChunkSize = extensible ? 40 : 16;
+
+    // WAVE id, fmt chunk, data chunk header and data, padded to an even size
+    const uint64_t riffSize = 4 + 8 + fmtChunkSize + 8 + dataSize + dataSize % 2;
+    const bool rf64 = riffSize > UINT32_MAX;
+
+    // Sizes that do not fit in 32 bits are 0xFFFFFFFF, with the real ones in a ds64 chunk
+    const uint64_t ds64ChunkSize = 3 * sizeof(uint64_t) + sizeof(uint32_t);
+    const uint32_t outputFileSize = rf64 ? UINT32_MAX : riffSize;
+    const uint32_t dataChunkSize = rf64 ? UINT32_MAX : dataSize;
+
+    // Write RIFF chunk
+    outFile.write(rf64 ? "RF64" : "RIFF", 4);
+    outFile.write(reinterpret_cast<const char*>(&outputFileSize), 4);
+    outFile.write("WAVE", 4);
+
+    // Write ds64 chunk, with an empty table of other chunk sizes
+    if (rf64) {
+        const uint64_t riffSize64 = riffSize + 8 + ds64ChunkSize;
+        const uint64_t sampleCount = dataSize / (header.numChannels * (header.bitsPerSample / 8));
+        const uint32_t chunkSize = ds64ChunkSize, tableLength = 0;
+        outFile.write("ds64", 4);
+        outFile.write(reinterpret_cast<const char*>(&chunkSize), 4);
+        outFile.write(reinterpret_cast<const char*>(&riffSize64), 8);
+        outFile.write(reinterpret_cast<const char*>(&dataSize), 8);
+        outFile.write(reinterpret_cast<const char*>(&sampleCount), 8);
+        outFile.write(reinterpret_cast<const char*>(&tableLength), 4);
+    }
+
+    // Write fmt chunk
+    outFile.write("fmt ", 4);
+    outFile.write(reinterpret_cast<const char*>(&fmtChunkSize), 4);
+    
+    // Write fmt chunk details directly from header
+    const uint16_t audioFormat = extensible ? WAVE_FORMAT_EXTENSIBLE : header.audioFormat;
+    outFile.write(reinterpret_cast<const char*>(&audioFormat), 2);
+    outFile.write(reinterpret_cast<const char*>(&header.numChannels), 2);
+    outFile.write(reinterpret_cast<const char*>(&header.sampleRate), 4);
+    outFile.write(reinterpret_cast<const char*>(&header.byteRate), 4);
+    outFile.write(reinterpret_cast<const char*>(&header.blockAlign), 2);
+    outFile.write(reinterpret_cast<const char*>(&header.bitsPerSample), 2);
+
+    // Extension size, valid bits, speaker positions and the subformat GUID, which is the
+    // format code followed by the fixed tail of the KSDATAFORMAT_SUBTYPE GUIDs
+    if (extensible) {
+        static const char GUID_TAIL[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, char(0x80), 0x00,
+                                           0x00, char(0xAA), 0x00, 0x38, char(0x9B), 0x71};
+        const uint16_t extensionSize = 22;
+        outFile.write(reinterpret_cast<const char*>(&extensionSize), 2);
+        outFile.write(reinterpret_cast<const char*>(&header.bitsPerSample), 2);
+        outFile.write(reinterpret_cast<const char*>(&header.channelMask), 4);
+        outFile.write(reinterpret_cast<const char*>(&header.audioFormat), 2);
+        outFile.write(GUID_TAIL, sizeof(GUID_TAIL));
+    }
+
+    // Write data chunk
+    outFile.write("data", 4);
+    outFile.write(reinterpret_cast<const char*>(&dataChunkSize), 4);
+}
+
+
+static const PcmCodec& PCM16 = *findPcmCodec(WAVE_FORMAT_PCM, 16);
+
+
+void AudioProcessor::pcm16ToFloat(const int16_t* input, float* output, size_t n) {
+    PCM16.decode(reinterpret_cast<const char*>(input), output, n);
+}
+
+
+void AudioProcessor::floatToPcm16(const float* input, int16_t* output, size_t n) {
+    encodeSamples(PCM16, input, reinterpret_cast<char*>(output), n);
+}
+
+
+void AudioProcessor::encodeSamples(const PcmCodec& codec, const float* input, char* output, size_t n) {
+    if (size_t saturated = codec.encode(input, output, n)) {
+        clipped.fetch_add(saturated, std::memory_order_relaxed);
+    }
+}
+
+
+void AudioProcessor::interleaveSamples(const PcmCodec& codec, const float* const* channels, size_t frames, size_t numChannels,
+                                       char* output) {
+    if (size_t saturated = codec.interleave(channels, frames, numChannels, output)) {
+        clipped.fetch_add(saturated, std::memory_order_relaxed);
+    }
 }
 
 
@@ -90,12 +490,15 @@ void AudioProcessor::printWavHeader() {
     std::cout << "Format: " << std::string(header.format, 4) << "\n";
     std::cout << "Subchunk1 ID: " << std::string(header.subchunk1ID, 4) << "\n";
     std::cout << "Subchunk1 Size: " << header.subchunk1Size << " bytes\n";
-    std::cout << "Audio Format: " << (header.audioFormat == 1 ? "PCM" : "Compressed") << "\n";
+    std::cout << "Audio Format: " << (header.audioFormat == WAVE_FORMAT_PCM ? "PCM" : header.audioFormat == WAVE_FORMAT_IEEE_FLOAT ? "IEEE float" : "Compressed") << "\n";
     std::cout << "Number of Channels: " << header.numChannels << "\n";
     std::cout << "Sample Rate: " << header.sampleRate << " Hz\n";
     std::cout << "Byte Rate: " << header.byteRate << " bytes/second\n";
     std::cout << "Block Align: " << header.blockAlign << " bytes\n";
     std::cout << "Bits Per Sample: " << header.bitsPerSample << " bits\n";
+    if (header.channelMask != 0) {
+        std::cout << "Channel Mask: 0x" << std::hex << header.channelMask << std::dec << "\n";
+    }
     std::cout << "Subchunk2 ID: " << std::string(header.subchunk2ID, 4) << "\n";
     std::cout << "Subchunk2 Size: " << header.subchunk2Size << " bytes\n";
 
@@ -104,23 +507,34 @@ void AudioProcessor::printWavHeader() {
 
 
 bool AudioProcessor::validWavFile() {
-    if (std::string(header.chunkID, 4) != "RIFF" || std::string(header.format, 4) != "WAVE") {
+    return validWavHeader(header);
+}
+
+
+bool AudioProcessor::validWavHeader(const WavHeader& header) {
+    std::string container(header.chunkID, 4);
+    if ((container != "RIFF" && container != "RF64" && container != "BW64") || std::string(header.format, 4) != "WAVE") {
         std::cerr << "Error: Not a valid WAV file.\n\n";
         return false;;
     }
 
-    if (header.audioFormat != 1) {
-        std::cerr << "Error: Only PCM format is supported.\n\n";
+    if (header.audioFormat != WAVE_FORMAT_PCM && header.audioFormat != WAVE_FORMAT_IEEE_FLOAT) {
+        std::cerr << "Error: Only PCM and IEEE float formats are supported.\n\n";
+        return false;
+    }
+
+    if (header.numChannels < 1 || header.numChannels > MAX_CHANNELS) {
+        std::cerr << "Error: Unsupported number of channels (1 to " << MAX_CHANNELS << ").\n\n";
         return false;
     }
 
-    if (header.numChannels != 1 && header.numChannels != 2) {
-        std::cerr << "Error: Unsupported number of channels (Only Stereo and Mono).\n\n";
+    if (!findPcmCodec(header.audioFormat, header.bitsPerSample)) {
+        std::cerr << "Error: Only 8, 16, 24 and 32-bit PCM and 32-bit float files are supported.\n\n";
         return false;
     }
 
-    if (header.bitsPerSample != 16) {
-        std::cerr << "Error: Only 16-bit PCM files are supported.\n\n";
+    if (header.blockAlign != header.numChannels * header.bitsPerSample / 8) {
+        std::cerr << "Error: Block align does not match the channels and bits per sample.\n\n";
         return false;
     }
 
@@ -129,7 +543,14 @@ bool AudioProcessor::validWavFile() {
 
 
 void AudioProcessor::writeOutputWav(const std::string& outputFile) {
-    if (leftChannel.empty() || (header.numChannels == 2 && rightChannel.empty())) {
+    save(outputFile);
+
+    std::cout << "Sucessfully saved to " << outputFile << "\n\n";
+}
+
+
+void AudioProcessor::save(const std::string& outputFile) {
+    if (viewLength == 0 || channels.size() != header.numChannels) {
         throw std::runtime_error("No audio data to write");
     }
 
@@ -139,80 +560,204 @@ void AudioProcessor::writeOutputWav(const std::string& outputFile) {
         throw std::runtime_error("Unable to open output file: " + outputFile);
     }
 
-    std::vector<int16_t> interleavedData;
+    // Written in the format it was read in
+    const PcmCodec& codec = *findPcmCodec(header.audioFormat, header.bitsPerSample);
+    const size_t numChannels = header.numChannels;
+    uint64_t dataSize = viewLength * numChannels * codec.bytes;
+    writeWavHeader(outFile, header, dataSize);
+
+    // Deferred operations, the view and interleaving in one pass a block at a time, converting
+    // once back to the file format and writing each block straight out, so the only copy of
+    // the audio is one block. A forward view is interleaved and converted straight from the
+    // channels, only a reversed one goes through float frames.
+    ScratchArena::Scope scope(scratch);
+    std::span<float> frames = scratch.allocate<float>(viewReversed ? WRITE_BLOCK * numChannels : 0);
+    std::span<char> samples = scratch.allocate<char>(WRITE_BLOCK * numChannels * codec.bytes);
+    const float* inputs[MAX_CHANNELS];
+
+    for (size_t start = 0; start < viewLength; start += WRITE_BLOCK) {
+        size_t count = std::min(WRITE_BLOCK, viewLength - start);
+        if (viewReversed) {
+            renderFrames(start, count, frames.data());
+            encodeSamples(codec, frames.data(), samples.data(), count * numChannels);
+        } else {
+            size_t begin = viewOffset + start;
+            runPending(begin, begin + count);
+            for (size_t c = 0; c < numChannels; c++) {
+                inputs[c] = channels[c].data() + begin;
+            }
+            interleaveSamples(codec, inputs, count, numChannels, samples.data());
+        }
+        outFile.write(samples.data(), count * numChannels * codec.bytes);
+    }
+    pending.clear();
 
-    // Correctly interleave stereo channels
-    if (header.numChannels == 2) {
-        size_t numSamples = std::min(leftChannel.size(), rightChannel.size());
-        interleavedData.reserve(numSamples * 2);
+    // Chunks are padded to an even size
+    if (dataSize % 2) {
+        outFile.put(0);
+    }
 
-        for (size_t i = 0; i < numSamples; i++) {
-            interleavedData.push_back(leftChannel[i]);
-            interleavedData.push_back(rightChannel[i]);
+    outFile.close();
+
+    if (!outFile) {
+        throw std::runtime_error("Failed to write output file: " + outputFile);
+    }
+}
+
+
+// Decimal text of every 16-bit magnitude, formatted once with to_chars: the number of digits,
+// then the digits. Looking a sample up is several times faster than formatting it.
+struct DigitTable {
+    char entries[32769][8];
+
+    DigitTable() {
+        for (int value = 0; value <= 32768; value++) {
+            char* digits = entries[value] + 1;
+            entries[value][0] = std::to_chars(digits, entries[value] + 8, value).ptr - digits;
         }
-    } else {
-        // Mono case
-        interleavedData = leftChannel;
     }
+};
 
-    // Calculate sizes
-    uint32_t dataSize = interleavedData.size() * sizeof(int16_t);
-    uint32_t outputFileSize = sizeof(WavHeader) - 8 + dataSize;
 
-    // Write RIFF chunk
-    outFile.write(header.chunkID, 4);
-    outFile.write(reinterpret_cast<char*>(&outputFileSize), 4);
-    outFile.write(header.format, 4);
+// Two digits of every number from 00 to 99
+static constexpr char PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
-    // Write fmt chunk
-    outFile.write("fmt ", 4);
-    uint32_t fmtChunkSize = 16; // Standard size for PCM
-    outFile.write(reinterpret_cast<char*>(&fmtChunkSize), 4);
-    
-    // Write fmt chunk details directly from header
-    outFile.write(reinterpret_cast<char*>(&header.audioFormat), 2);
-    outFile.write(reinterpret_cast<char*>(&header.numChannels), 2);
-    outFile.write(reinterpret_cast<char*>(&header.sampleRate), 4);
-    outFile.write(reinterpret_cast<char*>(&header.byteRate), 4);
-    outFile.write(reinterpret_cast<char*>(&header.blockAlign), 2);
-    outFile.write(reinterpret_cast<char*>(&header.bitsPerSample), 2);
 
-    // Write data chunk
-    outFile.write("data", 4);
-    outFile.write(reinterpret_cast<char*>(&dataSize), 4);
+// Appends a sample, writing up to 8 bytes past its text
+static char* appendSample(char* out, int16_t sample) {
+    static const DigitTable table;
+
+    *out = '-';
+    out += sample < 0;
+    const char* entry = table.entries[std::abs(static_cast<int>(sample))];
+    std::memcpy(out, entry + 1, 7);
+    return out + entry[0];
+}
 
-    // Write actual audio data
-    outFile.write(reinterpret_cast<char*>(interleavedData.data()), dataSize);
 
-    outFile.close();
+// Formats interleaved samples one frame per line, optionally after the time of the frame in
+// seconds to the microsecond. Returns the end of the text.
+static char* formatLines(const int16_t* samples, size_t count, size_t numChannels, char separator,
+                         bool timeColumn, size_t firstFrame, uint32_t sampleRate, char* out) {
+    // Time of the frame as whole seconds and microseconds, rounded down. Only the first frame
+    // divides, later ones step by 1e6 / sampleRate and carry the remainder.
+    const uint64_t start = static_cast<uint64_t>(firstFrame) * 1000000;
+    uint64_t seconds = start / sampleRate / 1000000;
+    uint32_t micros = start / sampleRate % 1000000;
+    uint32_t remainder = start % sampleRate;
+    const uint32_t step = 1000000 / sampleRate;
+    const uint32_t stepRemainder = 1000000 % sampleRate;
+
+    char secondsText[24];
+    size_t secondsLength = std::to_chars(secondsText, secondsText + sizeof(secondsText), seconds).ptr - secondsText;
+
+    for (size_t i = 0; i < count; i++) {
+        if (timeColumn) {
+            std::memcpy(out, secondsText, secondsLength);
+            out += secondsLength;
+            *out++ = '.';
+            std::memcpy(out, PAIRS + 2 * (micros / 10000), 2);
+            std::memcpy(out + 2, PAIRS + 2 * (micros / 100 % 100), 2);
+            std::memcpy(out + 4, PAIRS + 2 * (micros % 100), 2);
+            out += 6;
+            *out++ = separator;
+
+            micros += step;
+            remainder += stepRemainder;
+            if (remainder >= sampleRate) {
+                remainder -= sampleRate;
+                micros++;
+            }
+            if (micros >= 1000000) {
+                micros -= 1000000;
+                seconds++;
+                secondsLength = std::to_chars(secondsText, secondsText + sizeof(secondsText), seconds).ptr - secondsText;
+            }
+        }
 
-    std::cout << "Sucessfully saved to " << outputFile << "\n\n";
+        out = appendSample(out, samples[i * numChannels]);
+        for (size_t c = 1; c < numChannels; c++) {
+            *out++ = separator;
+            out = appendSample(out, samples[i * numChannels + c]);
+        }
+        *out++ = '\n';
+    }
+
+    return out;
 }
 
 
-void AudioProcessor::writeOutputTxt(const std::string& outputFile) {
-    std::ofstream outFile;
-    outFile.open(outputFile);
+void AudioProcessor::writeOutputTxt(const std::string& outputFile, bool timeColumn) {
+    std::ofstream outFile(outputFile, std::ios::binary);
     if (!outFile) {
         throw std::runtime_error("Unable to open file: " + outputFile);
     }
 
-    if (header.numChannels == 2) {
-        // Stereo
-        for (int i = 0; i < leftChannel.size(); i++) {
-            outFile << leftChannel[i] << " " << rightChannel[i] << '\n';
-        }
-    } else if (header.numChannels == 1) {
-        // Mono
-        for (int i = 0; i < leftChannel.size(); i++) {
-            outFile << leftChannel[i] << '\n';
+    // Always requantised to 16-bit values, whatever the format of the file, so the dump only
+    // matches the .wav output for 16-bit files. Chunks are rendered and formatted on the
+    // global pool, a chunk per thread at a time, and written in order.
+    const size_t numChannels = channels.size();
+    const char separator = timeColumn ? ',' : ' ';
+    ThreadPool& pool = ThreadPool::global();
+    const size_t slots = pool.size();
+
+    ScratchArena::Scope scope(scratch);
+    std::vector<std::span<float>> frames;
+    std::vector<std::span<int16_t>> samples;
+    std::vector<std::span<char>> text;
+    std::vector<size_t> lengths(slots);
+    for (size_t t = 0; t < slots; t++) {
+        frames.push_back(scratch.allocate<float>(TEXT_CHUNK * numChannels));
+        samples.push_back(scratch.allocate<int16_t>(TEXT_CHUNK * numChannels));
+        text.push_back(scratch.allocate<char>(TEXT_CHUNK * (MAX_TIME_CHARS + numChannels * MAX_SAMPLE_CHARS) + TEXT_SLACK));
+    }
+
+    if (timeColumn) {
+        if (numChannels <= 2) {
+            outFile << (numChannels == 2 ? "time,left,right\n" : "time,sample\n");
+        } else {
+            outFile << "time";
+            for (size_t c = 0; c < numChannels; c++) {
+                outFile << ",ch" << c;
+            }
+            outFile << '\n';
         }
+    }
 
+    for (size_t round = 0; round < viewLength; round += slots * TEXT_CHUNK) {
+        const size_t tasks = std::min(slots, (viewLength - round + TEXT_CHUNK - 1) / TEXT_CHUNK);
+
+        // Chunks cover separate stored samples, so their deferred operations run side by side
+        pool.parallelFor(tasks, [&](size_t t) {
+            size_t start = round + t * TEXT_CHUNK;
+            size_t count = std::min(TEXT_CHUNK, viewLength - start);
+            renderFrames(start, count, frames[t].data());
+            // Clipping is left for w to count, so dumping and then saving counts it once
+            PCM16.encode(frames[t].data(), reinterpret_cast<char*>(samples[t].data()), count * numChannels);
+            char* end = formatLines(samples[t].data(), count, numChannels, separator, timeColumn, start, header.sampleRate, text[t].data());
+            lengths[t] = end - text[t].data();
+        });
+
+        for (size_t t = 0; t < tasks; t++) {
+            outFile.write(text[t].data(), lengths[t]);
+        }
     }
+    pending.clear();
 
     outFile.close();
+    if (!outFile) {
+        throw std::runtime_error("Failed to write output file: " + outputFile);
+    }
 
-    std::cout << "Left " << leftChannel.size() << " and " << "Right " << rightChannel.size() << " samples saved to " << outputFile << "\n\n";
+    if (numChannels <= 2) {
+        size_t rightSamples = numChannels == 2 ? viewLength : 0;
+        std::cout << "Left " << viewLength << " and " << "Right " << rightSamples << " samples saved to " << outputFile << "\n\n";
+    } else {
+        std::cout << viewLength << " samples of " << numChannels << " channels saved to " << outputFile << "\n\n";
+    }
 }
 
 
@@ -235,13 +780,13 @@ void AudioProcessor::trimAudio(float startDuration, float endDuration) {
     int startIndex = startDuration * header.sampleRate;
     int endIndex = endDuration * header.sampleRate;
 
-    leftChannel.erase(leftChannel.begin(), leftChannel.begin() + startIndex);
-    leftChannel.erase(leftChannel.begin() + (endIndex - startIndex), leftChannel.end());
+    // Only the view moves, the samples stay where they are
+    auto [begin, end] = storedRange(startIndex, endIndex);
+    viewOffset = begin;
+    viewLength = end - begin;
 
-    if (header.numChannels == 2) {
-        // Stereo
-        rightChannel.erase(rightChannel.begin(), rightChannel.begin() + startIndex);
-        rightChannel.erase(rightChannel.begin() + (endIndex - startIndex), rightChannel.end());
+    if (storedFrames() > COMPACT_RATIO * viewLength) {
+        evaluate();
     }
 
     totalDuration = static_cast<float>(endIndex - startIndex) / header.sampleRate;
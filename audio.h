@@ -10,6 +10,44 @@
 #include <stdexcept>
 #include <cmath>
 #include <climits>
+#include <algorithm>
+#include <utility>
+
+#include "design.h"
+#include "arena.h"
+#include "pcm.h"
+
+
+// Equaliser implementation, defined in dsp.h
+enum class EqEngine;
+
+
+// Channel selection, bit c selects channel c
+using ChannelMask = uint64_t;
+
+// Most channels a file can have, one per bit of a ChannelMask
+constexpr size_t MAX_CHANNELS = 64;
+
+// Selections of the l, r and b arguments, b being every channel the audio has
+constexpr ChannelMask LEFT_CHANNEL = 1;
+constexpr ChannelMask RIGHT_CHANNEL = 2;
+constexpr ChannelMask ALL_CHANNELS = ~ChannelMask(0);
+
+/// @brief Parses a channel selection argument: l or left, r or right, b or both for every channel,
+/// or channel numbers from 0 separated by commas, eg. 0,2,3
+/// @param text argument to parse
+/// @param mask selection to fill
+/// @return false with an error printed if the argument is not a selection
+bool parseChannelMask(const std::string& text, ChannelMask& mask);
+
+/// @brief Channels of the audio a selection covers
+/// @param sel channels to select, ALL_CHANNELS for every one
+/// @param numChannels channels the audio has
+/// @return 0 with an error printed if the selection names a channel the audio does not have
+ChannelMask selectChannels(ChannelMask sel, size_t numChannels);
+
+/// @brief Names selected channels for messages, eg. "left and right channels" or "channels 0 and 2"
+std::string describeChannels(ChannelMask selected, size_t numChannels);
 
 
 class AudioProcessor {
@@ -18,7 +56,7 @@ public:
     #pragma pack(push, 1)
     // WAV file header structure
     struct WavHeader {
-        char chunkID[4];       // "RIFF"
+        char chunkID[4];       // "RIFF", "RF64" or "BW64"
         uint32_t chunkSize;    // File size - 8 bytes
         char format[4];        // "WAVE"
         char subchunk1ID[4];   // "fmt "
@@ -29,8 +67,9 @@ public:
         uint32_t byteRate;     // Bytes per second
         uint16_t blockAlign;   // Bytes per sample (all channels)
         uint16_t bitsPerSample;// Bits per sample
-        char subchunk2ID[4];   // "LIST"
+        char subchunk2ID[4];   // "LIST", or "data" without one
         uint32_t subchunk2Size;// Number of bytes in LIST
+        uint32_t channelMask;  // Speaker positions of WAVE_FORMAT_EXTENSIBLE files, 0 if unknown
     };
     #pragma pack(pop)
 
@@ -40,29 +79,110 @@ public:
     // Constructor Helper
     void initialise(const std::string& inputFile);
 
+    /// @brief Reads a .wav file like initialise without reporting it on stdout,
+    /// eg. when stdout carries a raw PCM stream
+    /// @param inputFile .wav file to read
+    void load(const std::string& inputFile);
+
+    /// @brief Runs gain and compression commands on every AudioProcessor lazily, queued and
+    /// fused into one pass over the samples when the audio is written or a command needs the
+    /// samples themselves.
+    static void setDeferred(bool enabled);
+    static bool getDeferred();
+
+    /// @brief Number of samples floatToPcm16, encodeSamples and interleaveSamples have saturated since the program started,
+    /// counted over every thread
+    static size_t getClippedSamples();
+
+    /// @brief Runs the queued operations and compacts the view, so the channels hold the audio
+    /// as the commands left it. Does nothing if nothing was deferred, trimmed or reversed.
+    void evaluate();
+
     // Getters for private data
     const WavHeader& getHeader() const { return header; }
     const float& getDuration() const { return totalDuration; }
-    const std::vector<int16_t>& getLeftChannel() const { return leftChannel; }
-    const std::vector<int16_t>& getRightChannel() const { return rightChannel; }
+    const std::vector<std::vector<float>>& getChannels() const { return channels; }
+    const std::vector<float>& getChannel(size_t c) const { return channels[c]; }
+    size_t getNumChannels() const { return channels.size(); }
+    /// @brief True until audio is loaded
+    bool empty() const { return storedFrames() == 0; }
+    /// @brief Samples the commands see over all channels, after trims
+    size_t getNumSamples() const { return viewLength * channels.size(); }
     const std::vector<char>& getListData() const { return listData; }
-    const std::vector<std::vector<double>>& getB() const { return b; }
-    const std::vector<std::vector<double>>& getA() const { return a; }
+    const std::vector<std::vector<Biquad>>& getEqualiserBands() const { return equaliserBands; }
+    const ScratchArena& getScratch() const { return scratch; }
 
     /// @brief Check if a .wav file is valid
     /// @return bool
     bool validWavFile();
 
+    /// @brief Check if a WavHeader describes a supported .wav file
+    /// @param header WAV header to check
+    /// @return bool
+    static bool validWavHeader(const WavHeader& header);
+
+    /// @brief Reads and validates the chunks of a RIFF, RF64 or BW64 WAV file up to the data
+    /// chunk, seeking over chunks other than fmt, LIST and ds64
+    /// @param inFile stream positioned at the start of the file, left at the first sample
+    /// @param header WAV header to fill
+    /// @param listData LIST chunk data to fill
+    /// @return size of the data chunk in bytes
+    static uint64_t readWavHeader(std::istream& inFile, WavHeader& header, std::vector<char>& listData);
+
+    /// @brief Writes a canonical PCM WAV header followed by the data chunk header, as RF64
+    /// with a ds64 chunk when the file is over 4 GB. Files of more than 2 channels or with
+    /// speaker positions get a WAVE_FORMAT_EXTENSIBLE fmt chunk. The RIFF size counts the
+    /// pad byte that has to follow data of an odd size.
+    /// @param outFile stream to write to
+    /// @param header WAV header holding the format details
+    /// @param dataSize size of the data chunk in bytes, without the pad byte
+    static void writeWavHeader(std::ostream& outFile, const WavHeader& header, uint64_t dataSize);
+
+    /// @brief Converts 16-bit PCM samples to floats in [-1, 1)
+    /// @param input samples to convert
+    /// @param output converted samples
+    /// @param n number of samples
+    static void pcm16ToFloat(const int16_t* input, float* output, size_t n);
+
+    /// @brief Converts floats in [-1, 1) to 16-bit PCM, rounding to nearest and saturating
+    /// @param input samples to convert
+    /// @param output converted samples
+    /// @param n number of samples
+    static void floatToPcm16(const float* input, int16_t* output, size_t n);
+
+    /// @brief Converts floats in [-1, 1) to samples of a file format, counting saturated ones
+    /// @param codec format of the output
+    /// @param input samples to convert
+    /// @param output converted samples
+    /// @param n number of samples
+    static void encodeSamples(const PcmCodec& codec, const float* input, char* output, size_t n);
+
+    /// @brief Interleaves planar float channels into samples of a file format, counting saturated ones
+    /// @param codec format of the output
+    /// @param channels one input per channel
+    /// @param frames number of frames
+    /// @param numChannels number of channels
+    /// @param output interleaved samples
+    static void interleaveSamples(const PcmCodec& codec, const float* const* channels, size_t frames, size_t numChannels,
+                                  char* output);
+
     /// @brief Print WavHeader information
     void printWavHeader();
 
-    /// @brief Writes the left and right channel vector into a WAV file
+    /// @brief Writes the channels into a WAV file
     /// @param outputFile 
     void writeOutputWav(const std::string& outputFile);
 
-    /// @brief Writes the left and right channel vector into a txt file
+    /// @brief Writes a WAV file like writeOutputWav without reporting it on stdout,
+    /// eg. when several files are processed at once
+    /// @param outputFile
+    void save(const std::string& outputFile);
+
+    /// @brief Writes the channels into a txt file as 16-bit values whatever the file format,
+    /// one frame per line, formatted on the global pool
     /// @param outputFile 
-    void writeOutputTxt(const std::string& outputFile);
+    /// @param timeColumn comma separated with a header and the time of each frame in seconds first
+    void writeOutputTxt(const std::string& outputFile, bool timeColumn = false);
 
     /// @brief Trims audio from start duration to end duration
     /// @param startDuration in seconds
@@ -72,34 +192,86 @@ public:
 
     /*************************** Friendly DSP Functions *****************************/ 
 
-    friend void volumeGain_dB(AudioProcessor& p, float gain_dB, char sel, float startDuration, float endDuration);
+    friend void volumeGain_dB(AudioProcessor& p, float gain_dB, ChannelMask sel, float startDuration, float endDuration);
+
+    friend void volumeGain(AudioProcessor& p, float gain, ChannelMask sel, float startDuration, float endDuration);
 
-    friend void volumeGain(AudioProcessor& p, float gain, char sel, float startDuration, float endDuration);
+    friend void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, ChannelMask sel);
 
-    friend void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, char sel);
+    friend void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, ChannelMask sel);
 
-    friend void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, char sel);
+    friend void equaliser(AudioProcessor& p, const std::vector<float>& gains, ChannelMask sel, EqEngine engine);
 
-    friend void equaliser(AudioProcessor& p, const std::vector<float>& gains, char sel);
+    friend void convolve(AudioProcessor& p, const AudioProcessor& ir, ChannelMask sel, size_t blockSize);
 
     friend void dynamicCompression(AudioProcessor& p, float threshold, int ratio, float makeUpGain, float startDuration, float endDuration);
 
     friend void reverseAudio(AudioProcessor& p);
 
+    // Runs a whole chain on the samples in place
+    friend class StreamProcessor;
+
 
 private:
     WavHeader header;                   // WAV header
 
     float totalDuration;                // Duration of the audio file
 
-    std::vector<int16_t> leftChannel;   // Left channel audio samples
-    std::vector<int16_t> rightChannel;  // Right channel audio samples
+    // Samples are kept as floats in [-1, 1) between load and write, so processing
+    // stages never requantise. Values outside the range saturate on write.
+    std::vector<std::vector<float>> channels;   // Planar samples of each channel, left and right first
 
     std::vector<char> listData;         // LIST data
 
-    // Equaliser Filter Coefficients
-    std::vector<std::vector<double>> b;
-    std::vector<std::vector<double>> a;
+    // Point-wise operation queued in deferred mode over stored samples [begin, end)
+    struct PendingOp {
+        enum class Type { Gain, Compression };
+
+        Type type;
+        ChannelMask channels;           // Channels the operation runs on
+        size_t begin;
+        size_t end;
+        float gain;
+        float threshold;
+        int ratio;
+        float makeUpGain;
+    };
+    std::vector<PendingOp> pending;
+
+    // Part of the stored samples the commands see. Trim and reverse only change the view,
+    // the samples are compacted when a command needs them contiguous or most of the
+    // storage has been trimmed away.
+    size_t viewOffset = 0;
+    size_t viewLength = 0;
+    bool viewReversed = false;
+
+    /// @brief Stored samples [begin, end) under frames [startIndex, endIndex) of the view
+    std::pair<size_t, size_t> storedRange(size_t startIndex, size_t endIndex) const;
+
+    /// @brief Queues a point-wise operation over [startIndex, endIndex) of the view
+    void defer(PendingOp op, size_t startIndex, size_t endIndex);
+
+    /// @brief Runs the queued operations over stored samples [begin, end), a block at a time
+    void runPending(size_t begin, size_t end);
+
+    /// @brief Runs the queued operations over frames [start, start + count) of the view and
+    /// copies them interleaved, in view order, to output
+    void renderFrames(size_t start, size_t count, float* output);
+
+    /// @brief Frames stored per channel, including any outside the view
+    size_t storedFrames() const { return channels.empty() ? 0 : channels[0].size(); }
+
+    /// @brief Makes the view cover all stored samples again
+    void resetView();
+
+    /// @brief Samples of each selected channel, in channel order
+    std::vector<float*> channelData(ChannelMask selected);
+
+    // Equaliser band filters designed for the file's sample rate
+    std::vector<std::vector<Biquad>> equaliserBands;
+
+    // Working memory of the DSP functions, kept between commands so repeating one reuses it
+    ScratchArena scratch;
 
 };
 
@@ -0,0 +1,173 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include "pool.h"
+
+namespace fs = std::filesystem;
+
+
+// Matches a file name against a pattern where * is any run of characters and ? any one
+static bool matchWildcard(const std::string& pattern, const std::string& name) {
+    size_t p = 0, n = 0;
+    size_t star = std::string::npos, resume = 0;
+
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = n;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            n = ++resume;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') p++;
+    return p == pattern.size();
+}
+
+
+BatchProcessor::BatchProcessor(const std::string& outputDir) : outputDir(outputDir) {}
+
+
+bool BatchProcessor::addChain(const std::vector<std::string>& tokens) {
+    return chain.addChain(tokens);
+}
+
+
+bool BatchProcessor::addFiles(const std::string& pattern) {
+    fs::path path(pattern);
+    std::string name = path.filename().string();
+
+    if (name.find_first_of("*?") == std::string::npos) {
+        files.push_back(pattern);
+        return true;
+    }
+
+    fs::path dir = path.has_parent_path() ? path.parent_path() : fs::path(".");
+    std::error_code error;
+    std::vector<std::string> matches;
+    for (const auto& entry : fs::directory_iterator(dir, error)) {
+        if (entry.is_regular_file() && matchWildcard(name, entry.path().filename().string())) {
+            matches.push_back((dir / entry.path().filename()).string());
+        }
+    }
+
+    if (matches.empty()) {
+        std::cerr << "Error: No files match " << pattern << "\n\n";
+        return false;
+    }
+
+    std::sort(matches.begin(), matches.end());
+    files.insert(files.end(), matches.begin(), matches.end());
+    return true;
+}
+
+
+bool BatchProcessor::addFileList(const std::string& listFile) {
+    std::ifstream list(listFile);
+    if (!list) {
+        std::cerr << "Error: Unable to open file list: " << listFile << "\n\n";
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty() && !addFiles(line)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+size_t BatchProcessor::process() {
+    // Files keep their names, so two inputs with the same name would overwrite each other
+    std::set<std::string> names;
+    for (const std::string& file : files) {
+        if (!names.insert(fs::path(file).filename().string()).second) {
+            std::cerr << "Error: More than one input file is named " << fs::path(file).filename() << "\n\n";
+            return files.size();
+        }
+    }
+
+    fs::create_directories(outputDir);
+
+    ThreadPool& pool = ThreadPool::global();
+
+    // Per worker state, reused from file to file
+    struct Worker {
+        AudioProcessor audio;
+        StreamProcessor chain;
+    };
+    std::vector<Worker> workers(pool.size(), Worker{AudioProcessor(), chain});
+
+    std::mutex report;
+    size_t failed = 0;
+    size_t totalFrames = 0;
+    size_t totalSamples = 0;
+    double totalDuration = 0.0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    pool.parallelForStealing(files.size(), [&](size_t w, size_t i) {
+        Worker& worker = workers[w];
+        const std::string& input = files[i];
+        std::string output = (fs::path(outputDir) / fs::path(input).filename()).string();
+
+        auto fileStart = std::chrono::steady_clock::now();
+
+        bool ok = false;
+        std::string error;
+        try {
+            worker.audio.load(input);
+            ok = worker.chain.apply(worker.audio);
+            if (ok) worker.audio.save(output);
+        } catch (std::exception& e) {
+            error = e.what();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - fileStart;
+
+        std::lock_guard<std::mutex> lock(report);
+        if (!ok) {
+            failed++;
+            std::cerr << "Error: Failed to process " << input << (error.empty() ? "\n\n" : ": " + error + "\n");
+            return;
+        }
+
+        size_t frames = worker.audio.getChannel(0).size();
+        size_t samples = frames * worker.audio.getHeader().numChannels;
+        totalFrames += frames;
+        totalSamples += samples;
+        totalDuration += worker.audio.getDuration();
+
+        std::cout << input << " -> " << output << ": " << frames << " frames in " << elapsed.count() * 1000.0 << " ms, "
+                  << samples / elapsed.count() << " samples/s, "
+                  << worker.audio.getDuration() / elapsed.count() << "x real time\n";
+    });
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    size_t processed = files.size() - failed;
+
+    std::cout << "\nProcessed " << processed << " of " << files.size() << " files (" << totalFrames << " frames) on "
+              << pool.size() << " threads in " << elapsed.count() << " sec: "
+              << processed / elapsed.count() << " files/s, "
+              << totalSamples / elapsed.count() << " samples/s, "
+              << totalDuration / elapsed.count() << "x real time\n\n";
+
+    return failed;
+}
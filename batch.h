@@ -0,0 +1,43 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "stream.h"
+
+
+class BatchProcessor {
+public:
+    /// @param outputDir directory the processed files are written to, under their own names
+    explicit BatchProcessor(const std::string& outputDir);
+
+    /// @brief Sets the chain run over every file, using the REPL command syntax
+    /// @param tokens tokens of the chain, eg. {"eq", "1", "1", "2", "1", "1", ";", "drc"}
+    /// @return false if any command is invalid
+    bool addChain(const std::vector<std::string>& tokens);
+
+    /// @brief Adds a file, or every file matching a pattern with * and ? in its file name,
+    /// so lists too long for the command line can be passed quoted, eg. "audio/*.wav"
+    /// @return false if a pattern matches nothing
+    bool addFiles(const std::string& pattern);
+
+    /// @brief Adds every line of a text file with addFiles
+    /// @return false if the list cannot be read or a line matches nothing
+    bool addFileList(const std::string& listFile);
+
+    /// @brief Runs the chain over every file on the global thread pool, one file per task.
+    /// Files take very different times, so idle threads steal files from busy ones. Each
+    /// thread keeps its own AudioProcessor and chain, reporting every file as it finishes
+    /// and the throughput of the whole batch at the end.
+    /// @return number of files that failed, all of them if the batch could not start
+    size_t process();
+
+private:
+    StreamProcessor chain;
+    std::string outputDir;
+    std::vector<std::string> files;
+};
+
+#endif
@@ -0,0 +1,99 @@
+// Times the FFT equaliser engine against the IIR engine and the original per band applyFiltfilt path
+//
+// Usage: bench_fft_eq [seconds] [sample rate] [threads]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "../dsp.h"
+
+
+// Transfer function of a cascade, for applyFiltfilt
+static void sectionsToTf(const std::vector<Biquad>& sections, std::vector<double>& b, std::vector<double>& a) {
+    b = {1.0};
+    a = {1.0};
+    for (const Biquad& s : sections) {
+        std::vector<double> nb(b.size() + 2, 0.0), na(a.size() + 2, 0.0);
+        for (size_t i = 0; i < b.size(); i++) {
+            nb[i] += b[i] * s.b0;
+            nb[i + 1] += b[i] * s.b1;
+            nb[i + 2] += b[i] * s.b2;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            na[i] += a[i];
+            na[i + 1] += a[i] * s.a1;
+            na[i + 2] += a[i] * s.a2;
+        }
+        b = nb;
+        a = na;
+    }
+}
+
+
+template <typename F>
+static double timeMs(F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 60.0;
+    uint32_t sampleRate = argc > 2 ? std::atoi(argv[2]) : 44100;
+    size_t threads = argc > 3 ? std::atoi(argv[3]) : 1;
+    if (seconds <= 0.0 || sampleRate == 0 || threads == 0) {
+        std::cerr << "Usage: " << argv[0] << " [seconds] [sample rate] [threads]\n";
+        return EXIT_FAILURE;
+    }
+    ThreadPool::setGlobalThreads(threads);
+
+    const size_t n = seconds * sampleRate;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    std::vector<float> input(n);
+    for (float& x : input) x = noise(rng);
+
+    const std::vector<float> gains = {1.0f, 2.0f, 0.5f, 1.5f, 3.0f};
+    const auto& bands = designBands(EQUALISER_LAYOUT, sampleRate);
+
+    // Original path, each band zero-phase filtered on its own and added up
+    std::vector<float> reference(n, 0.0f);
+    double filtfiltMs = timeMs([&] {
+        for (size_t k = 0; k < EQ_BANDS; k++) {
+            std::vector<double> b, a;
+            sectionsToTf(bands[k], b, a);
+            std::vector<float> band = applyFiltfilt(input, b, a);
+            for (size_t i = 0; i < n; i++) {
+                reference[i] += 0.7f * gains[k] * band[i];
+            }
+        }
+    });
+
+    ScratchArena scratch;
+    std::vector<float> iir(input);
+    double iirMs = timeMs([&] { equaliseChannels({iir.data()}, n, bands, gains, EqEngine::IIR, scratch); });
+
+    std::vector<float> fft(input);
+    double fftMs = timeMs([&] { equaliseChannels({fft.data()}, n, bands, gains, EqEngine::FFT, scratch); });
+
+    // Edges differ with each engine's start up, compare away from them
+    size_t edge = std::min<size_t>(sampleRate, n / 4);
+    double iirError = 0.0, fftError = 0.0;
+    for (size_t i = edge; i < n - edge; i++) {
+        iirError = std::max(iirError, static_cast<double>(std::abs(iir[i] - reference[i])));
+        fftError = std::max(fftError, static_cast<double>(std::abs(fft[i] - reference[i])));
+    }
+
+    std::cout << n << " samples at " << sampleRate << " Hz, " << threads << " thread(s)\n"
+              << std::fixed << std::setprecision(1)
+              << "applyFiltfilt  " << std::setw(9) << filtfiltMs << " ms\n"
+              << "IIR engine     " << std::setw(9) << iirMs << " ms  max difference " << std::scientific << std::setprecision(2) << iirError << "\n"
+              << std::fixed << std::setprecision(1)
+              << "FFT engine     " << std::setw(9) << fftMs << " ms  max difference " << std::scientific << std::setprecision(2) << fftError << "\n";
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,280 @@
+// Times the DSP functions and the WAV I/O paths over synthetic signals and prints the results as JSON,
+// one record per function, signal, sample rate, channel count and duration, so runs can be compared
+// to catch regressions. Each case runs the warmup repetitions untimed, then the timed ones, reloading
+// the input before each so in-place functions always see the same signal. ns_per_sample is the median
+// time over frames x channels, MB_per_s the 16-bit PCM size of the signal over the median time.
+//
+// Usage: bench_suite [-s seconds,...] [-r rates,...] [-c channels,...] [-g signals,...]
+//                    [-f functions,...] [-w warmup] [-n repetitions] [-j threads]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "../dsp.h"
+
+namespace fs = std::filesystem;
+
+
+struct Case {
+    std::string signal;
+    uint32_t sampleRate;
+    uint16_t channels;
+    double seconds;
+    size_t frames;
+};
+
+
+struct Benchmark {
+    std::string name;
+    // Run before every repetition, untimed
+    std::function<void(AudioProcessor& audio)> prepare;
+    std::function<void(AudioProcessor& audio)> run;
+};
+
+
+// Splits a comma separated list
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+
+// Transfer function of a cascade, for applyFilter and applyFiltfilt
+static void sectionsToTf(const std::vector<Biquad>& sections, std::vector<double>& b, std::vector<double>& a) {
+    b = {1.0};
+    a = {1.0};
+    for (const Biquad& s : sections) {
+        std::vector<double> nb(b.size() + 2, 0.0), na(a.size() + 2, 0.0);
+        for (size_t i = 0; i < b.size(); i++) {
+            nb[i] += b[i] * s.b0;
+            nb[i + 1] += b[i] * s.b1;
+            nb[i + 2] += b[i] * s.b2;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            na[i] += a[i];
+            na[i + 1] += a[i] * s.a1;
+            na[i + 2] += a[i] * s.a2;
+        }
+        b = nb;
+        a = na;
+    }
+}
+
+
+// Writes the signal of a case to a 16-bit WAV file, the same signal on every channel
+// except for noise, which is independent per channel
+static void writeSignal(const Case& c, const std::string& path) {
+    std::vector<float> samples(c.frames * c.channels, 0.0f);
+
+    if (c.signal == "sweep") {
+        // Exponential sine sweep from 20 Hz to 90% of Nyquist
+        const double f0 = 20.0, f1 = 0.45 * c.sampleRate;
+        const double rate = std::log(f1 / f0) / c.frames;
+        for (size_t i = 0; i < c.frames; i++) {
+            double phase = 2.0 * M_PI * f0 / c.sampleRate * (std::exp(rate * i) - 1.0) / rate;
+            float x = 0.5f * std::sin(phase);
+            for (size_t ch = 0; ch < c.channels; ch++) samples[i * c.channels + ch] = x;
+        }
+    } else if (c.signal == "noise") {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+        for (float& x : samples) x = noise(rng);
+    }
+
+    std::vector<int16_t> pcm(samples.size());
+    AudioProcessor::floatToPcm16(samples.data(), pcm.data(), samples.size());
+
+    AudioProcessor::WavHeader header = {};
+    header.audioFormat = 1;
+    header.numChannels = c.channels;
+    header.sampleRate = c.sampleRate;
+    header.bitsPerSample = 16;
+    header.blockAlign = c.channels * sizeof(int16_t);
+    header.byteRate = c.sampleRate * header.blockAlign;
+    const uint64_t dataSize = pcm.size() * sizeof(int16_t);
+
+    std::ofstream file(path, std::ios::binary);
+    AudioProcessor::writeWavHeader(file, header, dataSize);
+    file.write(reinterpret_cast<const char*>(pcm.data()), dataSize);
+    if (!file) {
+        throw std::runtime_error("Unable to write " + path + "\n");
+    }
+}
+
+
+static std::vector<Benchmark> benchmarks(const Case& c, const std::string& input, const std::string& output, const std::string& text) {
+    const ChannelMask sel = ALL_CHANNELS;
+    const std::vector<float> gains = {1.0f, 2.0f, 0.5f, 1.5f, 3.0f};
+
+    // Fourth order band of the equaliser, the heaviest single filter the REPL designs
+    auto tf = std::make_shared<std::pair<std::vector<double>, std::vector<double>>>();
+    sectionsToTf(designBands(EQUALISER_LAYOUT, c.sampleRate)[2], tf->first, tf->second);
+
+    auto reload = [input](AudioProcessor& audio) { audio.load(input); };
+    auto nothing = [](AudioProcessor&) {};
+
+    // The vector overloads return new channels, left for the function to allocate as callers would
+    auto perChannel = [](AudioProcessor& audio, const std::function<std::vector<float>(const std::vector<float>&)>& f) {
+        size_t samples = 0;
+        for (const std::vector<float>& channel : audio.getChannels()) {
+            samples += f(channel).size();
+        }
+        return samples;
+    };
+
+    return {
+        {"applyFilter", nothing, [=](AudioProcessor& audio) {
+            perChannel(audio, [&](const std::vector<float>& x) { return applyFilter(x, tf->first, tf->second); });
+        }},
+        {"applyFiltfilt", nothing, [=](AudioProcessor& audio) {
+            perChannel(audio, [&](const std::vector<float>& x) { return applyFiltfilt(x, tf->first, tf->second); });
+        }},
+        {"equaliser_iir", reload, [=](AudioProcessor& audio) { equaliser(audio, gains, sel, EqEngine::IIR); }},
+        {"equaliser_fft", reload, [=](AudioProcessor& audio) { equaliser(audio, gains, sel, EqEngine::FFT); }},
+        {"dynamicCompression", reload, [=](AudioProcessor& audio) {
+            dynamicCompression(audio, 0.5f, 4, 1.5f, 0.0f, audio.getDuration());
+        }},
+        {"initialise", nothing, [=](AudioProcessor& audio) { audio.initialise(input); }},
+        {"writeOutputWav", nothing, [=](AudioProcessor& audio) { audio.writeOutputWav(output); }},
+        {"writeOutputTxt", nothing, [=](AudioProcessor& audio) { audio.writeOutputTxt(text); }},
+        {"writeOutputCsv", nothing, [=](AudioProcessor& audio) { audio.writeOutputTxt(text, true); }},
+    };
+}
+
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> seconds = {"1", "10"};
+    std::vector<std::string> rates = {"16000", "44100", "96000"};
+    std::vector<std::string> channels = {"1", "2"};
+    std::vector<std::string> signals = {"sweep", "noise", "silence"};
+    std::vector<std::string> only;
+    int warmup = 1;
+    int repetitions = 5;
+    size_t threads = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: " << option << " needs a value\n\n";
+            return EXIT_FAILURE;
+        }
+        std::string value = argv[++i];
+        if (option == "-s") seconds = splitList(value);
+        else if (option == "-r") rates = splitList(value);
+        else if (option == "-c") channels = splitList(value);
+        else if (option == "-g") signals = splitList(value);
+        else if (option == "-f") only = splitList(value);
+        else if (option == "-w") warmup = std::atoi(value.c_str());
+        else if (option == "-n") repetitions = std::atoi(value.c_str());
+        else if (option == "-j") threads = std::atoi(value.c_str());
+        else {
+            std::cerr << "Usage: " << argv[0] << " [-s seconds,...] [-r rates,...] [-c channels,...] [-g signals,...]\n"
+                      << "       [-f functions,...] [-w warmup] [-n repetitions] [-j threads]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Case> cases;
+    for (const std::string& signal : signals) {
+        if (signal != "sweep" && signal != "noise" && signal != "silence") {
+            std::cerr << "Error: Unknown signal " << signal << " (sweep, noise or silence)\n\n";
+            return EXIT_FAILURE;
+        }
+        for (const std::string& r : rates) {
+            for (const std::string& ch : channels) {
+                for (const std::string& s : seconds) {
+                    Case c = {signal, static_cast<uint32_t>(std::atoi(r.c_str())), static_cast<uint16_t>(std::atoi(ch.c_str())), std::atof(s.c_str()), 0};
+                    c.frames = static_cast<size_t>(c.seconds * c.sampleRate);
+                    if (c.sampleRate == 0 || (c.channels != 1 && c.channels != 2) || c.frames == 0) {
+                        std::cerr << "Error: Invalid case " << signal << " " << r << " Hz, " << ch << " channels, " << s << " sec\n\n";
+                        return EXIT_FAILURE;
+                    }
+                    cases.push_back(c);
+                }
+            }
+        }
+    }
+
+    if (warmup < 0 || repetitions < 1 || threads == 0) {
+        std::cerr << "Error: Needs warmup >= 0, repetitions >= 1 and threads >= 1\n\n";
+        return EXIT_FAILURE;
+    }
+    ThreadPool::setGlobalThreads(threads);
+
+    std::random_device seed;
+    fs::path dir = fs::temp_directory_path() / ("bench_suite_" + std::to_string(seed()));
+    fs::create_directories(dir);
+    const std::string input = (dir / "input.wav").string();
+    const std::string output = (dir / "output.wav").string();
+    const std::string text = (dir / "output.txt").string();
+
+    // The REPL functions report on stdout, which is kept for the JSON
+    std::ostream json(std::cout.rdbuf());
+    json << std::setprecision(10);
+    std::ostringstream discard;
+    std::streambuf* console = std::cout.rdbuf(discard.rdbuf());
+
+    json << "{\n  \"threads\": " << threads << ",\n  \"warmup\": " << warmup << ",\n  \"repetitions\": " << repetitions
+         << ",\n  \"results\": [";
+
+    bool first = true;
+    AudioProcessor audio;
+    try {
+        for (const Case& c : cases) {
+            writeSignal(c, input);
+
+            for (const Benchmark& bench : benchmarks(c, input, output, text)) {
+                if (!only.empty() && std::find(only.begin(), only.end(), bench.name) == only.end()) continue;
+
+                audio.load(input);
+                std::vector<double> times;
+                for (int rep = 0; rep < warmup + repetitions; rep++) {
+                    bench.prepare(audio);
+                    auto start = std::chrono::steady_clock::now();
+                    bench.run(audio);
+                    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                    if (rep >= warmup) times.push_back(ns);
+                    discard.str("");
+                }
+
+                std::sort(times.begin(), times.end());
+                double median = times.size() % 2 ? times[times.size() / 2] : 0.5 * (times[times.size() / 2 - 1] + times[times.size() / 2]);
+                size_t samples = c.frames * c.channels;
+
+                json << (first ? "\n" : ",\n") << "    {\"name\": \"" << bench.name << "\", \"signal\": \"" << c.signal
+                     << "\", \"sample_rate\": " << c.sampleRate << ", \"channels\": " << c.channels << ", \"seconds\": " << c.seconds
+                     << ", \"samples\": " << samples << ", \"min_ns\": " << times.front() << ", \"median_ns\": " << median
+                     << ", \"max_ns\": " << times.back() << ", \"ns_per_sample\": " << median / samples
+                     << ", \"MB_per_s\": " << samples * sizeof(int16_t) / median * 1e3 << "}";
+                json.flush();
+                first = false;
+            }
+        }
+    } catch (std::exception& e) {
+        std::cout.rdbuf(console);
+        std::cerr << "Error: " << e.what();
+        fs::remove_all(dir);
+        return EXIT_FAILURE;
+    }
+
+    json << "\n  ]\n}\n";
+
+    std::cout.rdbuf(console);
+    fs::remove_all(dir);
+    return EXIT_SUCCESS;
+}
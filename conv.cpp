@@ -0,0 +1,170 @@
+#include "conv.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "pool.h"
+
+using Complex = std::complex<double>;
+
+
+IrSpectrum::IrSpectrum(const std::vector<float>& taps, size_t blockSize)
+    : block(blockSize), partitions(std::max<size_t>((taps.size() + blockSize - 1) / blockSize, 1)), fft(2 * blockSize) {
+    spectra.resize(partitions * numBins());
+
+    std::vector<double> padded(2 * block);
+    for (size_t p = 0; p < partitions; p++) {
+        std::fill(padded.begin(), padded.end(), 0.0);
+        for (size_t i = p * block; i < std::min(taps.size(), (p + 1) * block); i++) {
+            padded[i - p * block] = taps[i];
+        }
+        fft.forward(padded.data(), spectra.data() + p * numBins());
+    }
+}
+
+
+std::shared_ptr<const IrSpectrum> IrSpectrum::get(const std::vector<float>& taps, size_t blockSize) {
+    struct Entry {
+        uint64_t hash;
+        size_t length;
+        size_t blockSize;
+        std::shared_ptr<const IrSpectrum> spectrum;
+    };
+
+    // Most recently used first
+    static std::mutex mutex;
+    static std::list<Entry> cache;
+
+    // FNV-1a of the taps, so the cache never holds a copy of them
+    uint64_t hash = 14695981039346656037u;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(taps.data());
+    for (size_t i = 0; i < taps.size() * sizeof(float); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211u;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = std::find_if(cache.begin(), cache.end(), [&](const Entry& entry) {
+        return entry.hash == hash && entry.length == taps.size() && entry.blockSize == blockSize;
+    });
+    if (found != cache.end()) {
+        cache.splice(cache.begin(), cache, found);
+        return found->spectrum;
+    }
+
+    auto spectrum = std::make_shared<const IrSpectrum>(taps, blockSize);
+    cache.push_front({hash, taps.size(), blockSize, spectrum});
+    if (cache.size() > CACHE_ENTRIES) {
+        cache.pop_back();
+    }
+    return spectrum;
+}
+
+
+Convolver::Convolver(std::shared_ptr<const IrSpectrum> ir) : ir(std::move(ir)) {
+    window.resize(2 * this->ir->blockSize());
+    delayLine.resize(this->ir->numPartitions() * this->ir->numBins());
+    sum.resize(this->ir->numBins());
+    frame.resize(2 * this->ir->blockSize());
+    incomingFrame.resize(2 * this->ir->blockSize());
+}
+
+
+void Convolver::reset() {
+    std::fill(window.begin(), window.end(), 0.0);
+    std::fill(delayLine.begin(), delayLine.end(), 0.0);
+    newest = 0;
+}
+
+
+void Convolver::process(const float* input, float* output, size_t count) {
+    const size_t block = ir->blockSize();
+    const size_t bins = ir->numBins();
+    const size_t partitions = ir->numPartitions();
+
+    if (count > block) {
+        throw std::runtime_error("Convolver block is longer than the block size\n");
+    }
+
+    // Slide the window along by one block, a short last block is padded with silence
+    std::copy(window.begin() + block, window.end(), window.begin());
+    std::copy(input, input + count, window.begin() + block);
+    std::fill(window.begin() + block + count, window.end(), 0.0);
+
+    newest = (newest + partitions - 1) % partitions;
+    ir->transform().forward(window.data(), delayLine.data() + newest * bins);
+
+    if (!incoming) {
+        accumulate(*ir, frame);
+        for (size_t i = 0; i < count; i++) {
+            output[i] = frame[block + i];
+        }
+        return;
+    }
+
+    accumulate(*ir, frame);
+    accumulate(*incoming, incomingFrame);
+    for (size_t i = 0; i < count; i++) {
+        double mix = fadePosition < fadeFrames ? static_cast<double>(++fadePosition) / fadeFrames : 1.0;
+        output[i] = (1.0 - mix) * frame[block + i] + mix * incomingFrame[block + i];
+    }
+
+    if (fadePosition >= fadeFrames) {
+        ir = std::move(incoming);
+        incoming = nullptr;
+    }
+}
+
+
+void Convolver::crossfade(std::shared_ptr<const IrSpectrum> next, size_t frames) {
+    if (next->blockSize() != ir->blockSize() || next->numPartitions() != ir->numPartitions()) {
+        throw std::runtime_error("Crossfade needs responses with the same partitions\n");
+    }
+
+    if (incoming) {
+        throw std::runtime_error("Convolver is already crossfading\n");
+    }
+    incoming = std::move(next);
+    fadeFrames = frames;
+    fadePosition = 0;
+}
+
+
+void Convolver::accumulate(const IrSpectrum& response, std::vector<double>& result) {
+    const size_t bins = response.numBins();
+    const size_t partitions = response.numPartitions();
+
+    // Window transformed p blocks ago times partition p
+    std::fill(sum.begin(), sum.end(), 0.0);
+    for (size_t p = 0; p < partitions; p++) {
+        const Complex* x = delayLine.data() + ((newest + p) % partitions) * bins;
+        const Complex* h = response.partition(p);
+        for (size_t k = 0; k < bins; k++) {
+            sum[k] += x[k] * h[k];
+        }
+    }
+
+    // The first half of the result wraps around, the second half is the linear convolution
+    response.transform().inverse(sum.data(), result.data());
+}
+
+
+void convolveChannels(const std::vector<float*>& channels, size_t n, const std::vector<std::shared_ptr<const IrSpectrum>>& irs) {
+    if (irs.size() != channels.size()) {
+        throw std::runtime_error("Convolution needs an impulse response for every channel\n");
+    }
+
+    ThreadPool::global().parallelFor(channels.size(), [&](size_t c) {
+        Convolver convolver(irs[c]);
+
+        const size_t block = irs[c]->blockSize();
+        for (size_t start = 0; start < n; start += block) {
+            size_t count = std::min(block, n - start);
+            convolver.process(channels[c] + start, channels[c] + start, count);
+        }
+    });
+}
@@ -0,0 +1,103 @@
+#ifndef CONV_H
+#define CONV_H
+
+#include <complex>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "fft.h"
+
+
+/// @brief Impulse response cut into partitions of one block, each transformed once for
+/// overlap-save convolution with an FFT of twice the block size
+class IrSpectrum {
+public:
+    /// @param taps impulse response
+    /// @param blockSize samples convolved per block, a power of 2 >= 2
+    IrSpectrum(const std::vector<float>& taps, size_t blockSize);
+
+    /// @brief Spectrum of an impulse response from the process-wide cache, transforming it
+    /// only the first time the same taps are used with the same block size. The cache is
+    /// keyed on a hash of the taps and keeps the CACHE_ENTRIES most recently used spectra.
+    /// @param taps impulse response
+    /// @param blockSize samples convolved per block, a power of 2 >= 2
+    static std::shared_ptr<const IrSpectrum> get(const std::vector<float>& taps, size_t blockSize);
+
+    static constexpr size_t CACHE_ENTRIES = 4;
+
+    size_t blockSize() const { return block; }
+    size_t numPartitions() const { return partitions; }
+    size_t numBins() const { return block + 1; }
+    const RealFft& transform() const { return fft; }
+
+    /// @brief Spectrum of taps [p * blockSize, (p + 1) * blockSize)
+    const std::complex<double>* partition(size_t p) const { return spectra.data() + p * numBins(); }
+
+private:
+    size_t block;
+    size_t partitions;
+    RealFft fft;
+    std::vector<std::complex<double>> spectra;      // numBins per partition
+};
+
+
+/// @brief Uniformly partitioned overlap-save convolution of one channel. Each block is
+/// transformed once into a frequency domain delay line and multiplied with every partition,
+/// so the cost per sample grows with the number of partitions instead of the number of taps.
+class Convolver {
+public:
+    explicit Convolver(std::shared_ptr<const IrSpectrum> ir);
+
+    /// @brief Clears the input history
+    void reset();
+
+    /// @brief Switches to another response partitioned the same way, crossfading sample by
+    /// sample from the old one. The delay line holds only the input, so the new response
+    /// starts with its full history. Does not allocate.
+    /// @param next response to move to
+    /// @param frames length of the crossfade, 0 to switch at the next block
+    /// @throws if the previous crossfade has not finished
+    void crossfade(std::shared_ptr<const IrSpectrum> next, size_t frames);
+
+    bool fading() const { return incoming != nullptr; }
+
+    /// @brief Response in use, the old one until a crossfade finishes
+    const IrSpectrum* response() const { return ir.get(); }
+
+    /// @brief Convolves the next block of a stream. Drops the old response when a crossfade
+    /// ends, so whoever must not free it on this thread keeps a reference of its own.
+    /// @param input samples to convolve
+    /// @param output convolved samples, may be the same as input
+    /// @param count number of samples, blockSize except for a shorter last block
+    void process(const float* input, float* output, size_t count);
+
+private:
+    std::shared_ptr<const IrSpectrum> ir;
+
+    std::vector<double> window;                     // Previous block then current block
+    std::vector<std::complex<double>> delayLine;    // Spectra of the last numPartitions windows
+    std::vector<std::complex<double>> sum;          // Product of the delay line and the partitions
+    std::vector<double> frame;                      // Inverse transform of the sum
+    size_t newest = 0;                              // Delay line slot of the current window
+
+    // Crossfade to another response
+    std::shared_ptr<const IrSpectrum> incoming;
+    std::vector<double> incomingFrame;
+    size_t fadeFrames = 0;
+    size_t fadePosition = 0;
+
+    // Sums the delay line times the partitions of a response and transforms it back into frame
+    void accumulate(const IrSpectrum& response, std::vector<double>& result);
+};
+
+
+/// @brief Convolves equal length channels in place with the global pool, keeping their
+/// length so the tail of the impulse response past the last sample is cut off
+/// @param channels samples of each channel
+/// @param n number of samples per channel
+/// @param irs impulse response of each channel
+void convolveChannels(const std::vector<float*>& channels, size_t n, const std::vector<std::shared_ptr<const IrSpectrum>>& irs);
+
+
+#endif
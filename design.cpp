@@ -0,0 +1,110 @@
+#include "design.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+using Complex = std::complex<double>;
+
+// Highest usable edge as a fraction of Nyquist, the bilinear prewarp diverges at Nyquist
+constexpr double MAX_EDGE = 0.99;
+
+
+bool operator<(const BandSpec& x, const BandSpec& y) {
+    return std::tie(x.type, x.order, x.low, x.high) < std::tie(y.type, y.order, y.low, y.high);
+}
+
+
+std::vector<Biquad> butterworth(const BandSpec& band, double sampleRate) {
+    if (band.order < 1 || sampleRate <= 0.0 || band.low <= 0.0 ||
+        (band.type == BandType::BandPass && band.high <= band.low)) {
+        throw std::runtime_error("Invalid band filter specification\n");
+    }
+
+    // Analog edge in rad/s whose bilinear image is the digital edge
+    const double fs2 = 2.0 * sampleRate;
+    auto prewarp = [&](double hz) {
+        hz = std::min(hz, MAX_EDGE * sampleRate / 2.0);
+        return fs2 * std::tan(M_PI * hz / sampleRate);
+    };
+
+    // Normalised prototype poles on the left half of the unit circle
+    std::vector<Complex> prototype;
+    for (int k = 0; k < band.order; k++) {
+        prototype.push_back(std::polar(1.0, M_PI * (2.0 * k + band.order + 1) / (2.0 * band.order)));
+    }
+
+    std::vector<Complex> analogPoles;
+    std::vector<Complex> zeros;
+    Complex reference;          // Point on the unit circle normalised to unit gain
+
+    if (band.type == BandType::LowPass) {
+        double w = prewarp(band.low);
+        for (Complex p : prototype) analogPoles.push_back(w * p);
+        zeros.assign(band.order, -1.0);
+        reference = 1.0;
+    } else if (band.type == BandType::HighPass) {
+        double w = prewarp(band.low);
+        for (Complex p : prototype) analogPoles.push_back(w / p);
+        zeros.assign(band.order, 1.0);
+        reference = -1.0;
+    } else {
+        double w1 = prewarp(band.low);
+        double w2 = prewarp(band.high);
+        if (w2 <= w1) {
+            throw std::runtime_error("Band edges are above Nyquist\n");
+        }
+
+        // Each prototype pole splits into a pair around the centre frequency
+        double centre = std::sqrt(w1 * w2);
+        double width = w2 - w1;
+        for (Complex p : prototype) {
+            Complex half = p * width / 2.0;
+            Complex offset = std::sqrt(half * half - centre * centre);
+            analogPoles.push_back(half + offset);
+            analogPoles.push_back(half - offset);
+        }
+        zeros.assign(band.order, 1.0);
+        zeros.insert(zeros.end(), band.order, -1.0);
+        reference = std::polar(1.0, 2.0 * std::atan(centre / fs2));
+    }
+
+    // Bilinear transform, s = fs2 * (z - 1) / (z + 1)
+    std::vector<Complex> poles;
+    for (Complex s : analogPoles) {
+        poles.push_back((fs2 + s) / (fs2 - s));
+    }
+
+    Complex response = 1.0;
+    for (Complex z : zeros) response *= 1.0 - z / reference;
+    for (Complex p : poles) response /= 1.0 - p / reference;
+
+    return zpk2sos(zeros, poles, 1.0 / std::abs(response));
+}
+
+
+const std::vector<std::vector<Biquad>>& designBands(const std::vector<BandSpec>& layout, uint32_t sampleRate) {
+    static std::mutex mutex;
+    static std::map<std::pair<uint32_t, std::vector<BandSpec>>, std::vector<std::vector<Biquad>>> cache;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Map nodes never move, so returned designs stay valid as the cache grows
+    auto key = std::make_pair(sampleRate, layout);
+    auto found = cache.find(key);
+    if (found != cache.end()) {
+        return found->second;
+    }
+
+    std::vector<std::vector<Biquad>> bands;
+    for (const BandSpec& band : layout) {
+        bands.push_back(butterworth(band, sampleRate));
+    }
+
+    return cache.emplace(std::move(key), std::move(bands)).first->second;
+}
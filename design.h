@@ -0,0 +1,51 @@
+#ifndef DESIGN_H
+#define DESIGN_H
+
+#include <cstdint>
+#include <vector>
+
+#include "sos.h"
+
+
+enum class BandType { LowPass, BandPass, HighPass };
+
+// One Butterworth band filter, edges in Hz so the response is the same at any sample rate
+struct BandSpec {
+    BandType type;
+    int order;          // Prototype order, band-pass filters end up twice as long
+    double low;         // Cutoff of low-pass and high-pass filters, lower edge of band-pass filters
+    double high;        // Upper edge of band-pass filters, unused otherwise
+};
+
+bool operator<(const BandSpec& x, const BandSpec& y);
+
+
+// Sub-Bass, Bass, Midrange, Upper Midrange, Treble
+// Band edges of the original 16kHz design scaled to 44.1kHz: low-pass at 195.7Hz, band-pass
+// 154.4 - 633.9Hz, 468.6 - 2144.4Hz and 1730.9 - 6929.2Hz, high-pass at 5826.7Hz
+const std::vector<BandSpec> EQUALISER_LAYOUT = {
+    {BandType::LowPass,  1, 195.69375, 0.0},
+    {BandType::BandPass, 1, 154.35,    633.9375},
+    {BandType::BandPass, 1, 468.5625,  2144.3625},
+    {BandType::BandPass, 2, 1730.925,  6929.2125},
+    {BandType::HighPass, 2, 5826.7125, 0.0}
+};
+
+
+/// @brief Designs a digital Butterworth filter by bilinear transform, prewarped so the edges
+/// land exactly on their analog frequencies. Edges at or above Nyquist are pulled just below it.
+/// @param band filter type, order and edges
+/// @param sampleRate in Hz
+/// @return sections with unit gain at DC, Nyquist or the band centre
+std::vector<Biquad> butterworth(const BandSpec& band, double sampleRate);
+
+
+/// @brief Sections of each band of a layout at a sample rate. Designs are cached for the
+/// lifetime of the process, so every file at the same rate shares one design.
+/// @param layout band filters to design
+/// @param sampleRate in Hz
+/// @return sections of each band, valid until the process exits
+const std::vector<std::vector<Biquad>>& designBands(const std::vector<BandSpec>& layout, uint32_t sampleRate);
+
+
+#endif
@@ -1,6 +1,119 @@
 #include "dsp.h"
 
-void volumeGain_dB(AudioProcessor& p, float gain_dB, char sel, float startDuration, float endDuration) {
+// Frames passed to the SOS engine at a time, small enough to stay in cache
+constexpr size_t SOS_BLOCK_FRAMES = 256;
+
+// Relative error left by starting a filtfilt segment from an estimated state, once the
+// settling region has decayed it by this much
+constexpr double SEGMENT_SETTLE_TOLERANCE = 1e-9;
+
+// Shortest filtfilt segment worth running on its own thread, in samples
+constexpr size_t MIN_SEGMENT_SAMPLES = 1 << 16;
+
+// Smallest overlap-add block of the FFT equaliser, larger blocks spend less on the overlap
+constexpr size_t MIN_FFT_SIZE = 1 << 13;
+
+// Band buffers of the channels the IIR equaliser runs together are kept under this size,
+// beyond it channels run one at a time
+constexpr size_t EQ_GROUP_BYTES = size_t(1) << 29;
+
+// Filters channels through a bank with one lane per channel, a block of frames at a time
+static void filterLanes(SosFilter& sos, std::span<float* const> channels, size_t n, bool backward, std::span<double> frames) {
+    const size_t stride = sos.stride();
+
+    // Padding lanes start from silence too, so the kernel never sees stale values
+    std::fill(frames.begin(), frames.end(), 0.0);
+
+    for (size_t start = 0; start < n; start += SOS_BLOCK_FRAMES) {
+        size_t count = std::min(SOS_BLOCK_FRAMES, n - start);
+
+        for (size_t i = 0; i < count; i++) {
+            size_t index = backward ? n - 1 - (start + i) : start + i;
+            for (size_t c = 0; c < channels.size(); c++) {
+                frames[i * stride + c] = channels[c][index];
+            }
+        }
+
+        sos.process(frames.data(), frames.data(), count);
+
+        for (size_t i = 0; i < count; i++) {
+            size_t index = backward ? n - 1 - (start + i) : start + i;
+            for (size_t c = 0; c < channels.size(); c++) {
+                channels[c][index] = frames[i * stride + c];
+            }
+        }
+    }
+}
+
+// Filters channels as lanes of one SOS bank, or split into a bank of neighbouring channels per
+// thread when the global pool has more than one. Lanes are independent, so any split gives the
+// same result.
+static void runChannels(std::span<float* const> channels, size_t n, const std::vector<double>& b, const std::vector<double>& a,
+                        ScratchArena& scratch) {
+    ThreadPool& pool = ThreadPool::global();
+    const size_t groups = std::min(pool.size(), channels.size());
+
+    if (groups > 1) {
+        auto bound = [&](size_t g) { return g * channels.size() / groups; };
+
+        // Every thread gets its own filter and frames, set up here as the arena is not thread-safe
+        ScratchArena::Scope scope(scratch);
+        const std::vector<Biquad> sections = tf2sos(b, a);
+        std::vector<SosFilter> filters;
+        std::vector<std::span<double>> frames;
+        for (size_t g = 0; g < groups; g++) {
+            filters.emplace_back(std::vector<std::vector<Biquad>>(bound(g + 1) - bound(g), sections));
+            frames.push_back(scratch.allocate<double>(SOS_BLOCK_FRAMES * filters.back().stride()));
+        }
+
+        pool.parallelFor(groups, [&](size_t g) {
+            filterLanes(filters[g], channels.subspan(bound(g), bound(g + 1) - bound(g)), n, false, frames[g]);
+        });
+    } else {
+        filterChannels(channels, n, b, a, false, scratch);
+    }
+}
+
+// One pass of a cascade over processing positions [begin, end) of equal length channels.
+// Position t is sample t forwards or sample length - 1 - t backwards. The state starts at the
+// steady state for the sample `settle` positions before begin, and the outputs of that
+// settling region are discarded.
+// frames holds SOS_BLOCK_FRAMES frames of the filter's stride.
+static void sweepChannels(const std::vector<const float*>& src, const std::vector<float*>& dst, size_t length,
+                          const std::vector<Biquad>& sections, size_t begin, size_t end, size_t settle, bool backward,
+                          std::span<double> frames) {
+    auto index = [&](size_t t) { return backward ? length - 1 - t : t; };
+
+    SosFilter sos(std::vector<std::vector<Biquad>>(src.size(), sections));
+    const size_t stride = sos.stride();
+    std::fill(frames.begin(), frames.end(), 0.0);
+
+    size_t first = begin - std::min(begin, settle);
+    std::vector<double> zi = sosStepState(sections);
+    for (size_t c = 0; c < src.size(); c++) {
+        sos.setState(c, zi, src[c][index(first)]);
+    }
+
+    for (size_t start = first; start < end; start += SOS_BLOCK_FRAMES) {
+        size_t count = std::min(SOS_BLOCK_FRAMES, end - start);
+
+        for (size_t i = 0; i < count; i++) {
+            for (size_t c = 0; c < src.size(); c++) {
+                frames[i * stride + c] = src[c][index(start + i)];
+            }
+        }
+
+        sos.process(frames.data(), frames.data(), count);
+
+        for (size_t i = std::max(start, begin) - start; i < count; i++) {
+            for (size_t c = 0; c < dst.size(); c++) {
+                dst[c][index(start + i)] = frames[i * stride + c];
+            }
+        }
+    }
+}
+
+void volumeGain_dB(AudioProcessor& p, float gain_dB, ChannelMask sel, float startDuration, float endDuration) {
     if (gain_dB < -48.0f || gain_dB > 48.0f) {
         std::cerr << "Error: Gain must be between -48dB and 48dB\n\n";
         return;
@@ -10,27 +123,17 @@ void volumeGain_dB(AudioProcessor& p, float gain_dB, char sel, float startDurati
     volumeGain(p, gain, sel, startDuration, endDuration);
 }
 
-void volumeGain(AudioProcessor& p, float gain, char sel, float startDuration, float endDuration) {
+void volumeGain(AudioProcessor& p, float gain, ChannelMask sel, float startDuration, float endDuration) {
     if (gain < 0.0f || gain > 255.0f) {
         std::cerr << "Error: Gain must be between 0 and 255\n\n";
         return;
     }
 
-    sel = tolower(sel);
-    if (sel != 'l' && sel != 'r' && sel != 'b') {
-        std::cerr << "Error: Invalid channel selection (l, r, or b) \n\n";
+    const ChannelMask selected = selectChannels(sel, p.channels.size());
+    if (!selected) {
         return;
     }
 
-    if (sel == 'r' && p.getRightChannel().empty()) {
-        std::cerr << "Audio is mono and does not have a right channel" << "\n\n";
-        return;
-    }
-    
-    if (sel == 'b' && p.getRightChannel().empty()) {
-        sel = 'l';
-    }
-
     if (startDuration < 0.0f || startDuration > p.totalDuration) {
         std::cerr << "Error: Start duration must be between 0 and " << p.totalDuration << " sec\n\n";
         return;
@@ -49,60 +152,74 @@ void volumeGain(AudioProcessor& p, float gain, char sel, float startDuration, fl
     int startIndex = startDuration * p.header.sampleRate;
     int endIndex = endDuration * p.header.sampleRate;
 
-    // Process left channel
-    if (sel == 'l' || sel == 'b') {
-        p.leftChannel = applyVolumeGain(p.leftChannel, gain, startIndex, endIndex);
-    }
+    if (AudioProcessor::getDeferred()) {
+        AudioProcessor::PendingOp op{AudioProcessor::PendingOp::Type::Gain, selected};
+        op.gain = gain;
+        p.defer(op, startIndex, endIndex);
+    } else {
+        auto [begin, end] = p.storedRange(startIndex, endIndex);
 
-    // Process right channel
-    if (sel == 'r' || sel == 'b') {
-        p.rightChannel = applyVolumeGain(p.rightChannel, gain, startIndex, endIndex);
+        for (float* channel : p.channelData(selected)) {
+            applyVolumeGain(std::span(channel, p.storedFrames()), gain, begin, end);
+        }
     }
 
-    std::cout << "Successfully applied gain of " << gain << " to ";
-    if (sel == 'l')
-        std::cout << "left channel ";
-    else if (sel == 'r')
-        std::cout << "right channel ";
-    else if (sel == 'b')
-        std::cout << "left and right channels ";
-
+    std::cout << "Successfully applied gain of " << gain << " to " << describeChannels(selected, p.channels.size()) << " ";
     std::cout << "from " << startDuration << " to " << endDuration << " sec ";
     std::cout << "[" << startIndex << " - " << endIndex << ")\n\n";
 }
 
-std::vector<int16_t> applyVolumeGain(const std::vector<int16_t>& input, float gain, int startIndex, int endIndex) {
-    if (gain < 0.0f || gain > 255.0f) {
-        std::cerr << "Error: Gain must be between 0 and 255\n\n";
+std::vector<float> applyVolumeGain(const std::vector<float>& input, float gain, int startIndex, int endIndex) {
+    if (startIndex < 0 || endIndex < 0) {
+        std::cerr << "Error: Start and end index must not be negative\n\n";
         return {};
     }
 
-    if (startIndex < 0 || startIndex > input.size()) {
-        std::cerr << "Error: Start index must be between 0 and " << input.size() << " sec\n\n";
+    std::vector<float> gainChannel = input;
+
+    if (!applyVolumeGain(std::span(gainChannel), gain, static_cast<size_t>(startIndex), static_cast<size_t>(endIndex))) {
         return {};
     }
 
-    if (endIndex < 0 || endIndex > input.size()) {
-        std::cerr << "Error: End index must be between 0 and " << input.size() << " sec\n\n";
-        return {};
+    return gainChannel;
+}
+
+bool applyVolumeGain(std::span<float> samples, float gain, size_t startIndex, size_t endIndex) {
+    if (gain < 0.0f || gain > 255.0f) {
+        std::cerr << "Error: Gain must be between 0 and 255\n\n";
+        return false;
+    }
+
+    if (startIndex > samples.size()) {
+        std::cerr << "Error: Start index must be between 0 and " << samples.size() << " sec\n\n";
+        return false;
+    }
+
+    if (endIndex > samples.size()) {
+        std::cerr << "Error: End index must be between 0 and " << samples.size() << " sec\n\n";
+        return false;
     }
 
     if (startIndex > endIndex) {
         std::cerr << "Error: Start index must be before end index\n\n";
-        return {};
+        return false;
     }  
 
-    std::vector<int16_t> gainChannel = input;
+    scaleSamples(samples.subspan(startIndex, endIndex - startIndex), gain);
 
-    for (size_t i = startIndex; i < endIndex; i++) {
-        int32_t scaledSample = static_cast<int32_t>(input[i]) * gain;
-        gainChannel[i] = std::max(std::min(scaledSample, INT16_MAX), INT16_MIN);
-    }
+    return true;
+}
 
-    return gainChannel;
+void scaleSamples(std::span<float> samples, float gain) {
+    for (float& sample : samples) {
+        sample *= gain;
+    }
 }
 
-void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, char sel) {
+void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, ChannelMask sel) {
+    // Runs on the samples themselves, so deferred commands have to run first
+    p.evaluate();
+
     if (b.empty() || a.empty()) {
         std::cerr << "Error: Filter coefficients must not be empty\n\n";
         return;
@@ -113,20 +230,10 @@ void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<d
         return;
     }
 
-    sel = tolower(sel);
-    if (sel != 'l' && sel != 'r' && sel != 'b') {
-        std::cerr << "Error: Invalid channel selection (l, r, or b) \n\n";
-        return;
-    }
-
-    if (sel == 'r' && p.getRightChannel().empty()) {
-        std::cerr << "Audio is mono and does not have a right channel" << "\n\n";
+    const ChannelMask selected = selectChannels(sel, p.channels.size());
+    if (!selected) {
         return;
     }
-    
-    if (sel == 'b' && p.getRightChannel().empty()) {
-        sel = 'l';
-    }
 
     std::vector<double> b_norm = b;
     std::vector<double> a_norm = a;
@@ -140,27 +247,15 @@ void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<d
         std::cout << "Normalised Filter Coefficients\n";
     }
 
-    // Process left channel
-    if (sel == 'l' || sel == 'b') {
-        p.leftChannel = applyFilter(p.leftChannel, b_norm, a_norm);
-    }
+    // Selected channels filter side by side, one per lane
+    std::vector<float*> channels = p.channelData(selected);
+    runChannels(channels, p.storedFrames(), b_norm, a_norm, p.scratch);
 
-    // Process right channel
-    if (sel == 'r' || sel == 'b') {
-        p.rightChannel = applyFilter(p.rightChannel, b_norm, a_norm);
-    }
-
-    std::cout << "Successfully applied filter on ";
-    if (sel == 'l')
-        std::cout << "left channel\n\n";
-    else if (sel == 'r')
-        std::cout << "right channel\n\n";
-    else if (sel == 'b')
-        std::cout << "left and right channels\n\n";
+    std::cout << "Successfully applied filter on " << describeChannels(selected, p.channels.size()) << "\n\n";
 
 }
 
-std::vector<int16_t> applyFilter(const std::vector<int16_t>& input, const std::vector<double>& b, const std::vector<double>& a) {
+std::vector<float> applyFilter(const std::vector<float>& input, const std::vector<double>& b, const std::vector<double>& a) {
     /*
 
         b0 + b1*z^(-1) + b2*z^(-2) + ...
@@ -168,39 +263,41 @@ std::vector<int16_t> applyFilter(const std::vector<int16_t>& input, const std::v
         1 + a1*z^(-1) + a2*z^(-2) + ...
 
 
-    y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2] - a1*y[n-1] - a2*y[n-2]    
-    
+    Factored into second-order sections, each one
+
+         b0 + b1*z^(-1) + b2*z^(-2)
+    Hk = --------------------------
+         1 + a1*z^(-1) + a2*z^(-2)
+
     */
 
-    std::vector<int16_t> filteredChannel(input.size(), 0);
-    
-    for (size_t i = 0; i < input.size(); i++) {
-        double sum = 0.0;  // to avoid overflow and maintian precision
-        
-        // b coefficients
-        for (size_t j = 0; j < b.size(); j++) {
-            if (i >= j) {
-                // b[j] * x[n-j]
-                sum += b[j] * static_cast<double>(input[i - j]);  
-            }
-        }
-        
-        // a coefficients
-        // Skip a[0] since it's normalized to 1
-        for (size_t k = 1; k < a.size(); k++) {  
-            if (i >= k) {
-                // a[k] * y[n-k]
-                sum -= a[k] * static_cast<double>(filteredChannel[i - k]);    
-            }
-        }
+    std::vector<float> filteredChannel = input;
+
+    ScratchArena scratch;
+    applyFilter(std::span(filteredChannel), b, a, scratch);
 
-        filteredChannel[i] = static_cast<int16_t>(std::min(std::max(sum, static_cast<double>(INT16_MIN)), static_cast<double>(INT16_MAX)));
-    }
-    
     return filteredChannel;
 }
 
-void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, char sel) {
+void applyFilter(std::span<float> samples, const std::vector<double>& b, const std::vector<double>& a, ScratchArena& scratch) {
+    float* channel = samples.data();
+    filterChannels(std::span(&channel, 1), samples.size(), b, a, false, scratch);
+}
+
+void filterChannels(std::span<float* const> channels, size_t n, const std::vector<double>& b, const std::vector<double>& a,
+                    bool backward, ScratchArena& scratch) {
+    if (channels.empty()) return;
+
+    SosFilter sos(std::vector<std::vector<Biquad>>(channels.size(), tf2sos(b, a)));
+
+    ScratchArena::Scope scope(scratch);
+    filterLanes(sos, channels, n, backward, scratch.allocate<double>(SOS_BLOCK_FRAMES * sos.stride()));
+}
+
+void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, ChannelMask sel) {
+    // Runs on the samples themselves, so deferred commands have to run first
+    p.evaluate();
+
     if (b.empty() || a.empty()) {
         std::cerr << "Error: Filter coefficients must not be empty\n\n";
         return;
@@ -211,21 +308,11 @@ void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector
         return;
     }
 
-    sel = tolower(sel);
-    if (sel != 'l' && sel != 'r' && sel != 'b') {
-        std::cerr << "Error: Invalid channel selection (l, r, or b) \n\n";
+    const ChannelMask selected = selectChannels(sel, p.channels.size());
+    if (!selected) {
         return;
     }
 
-    if (sel == 'r' && p.getRightChannel().empty()) {
-        std::cerr << "Audio is mono and does not have a right channel" << "\n\n";
-        return;
-    }
-    
-    if (sel == 'b' && p.getRightChannel().empty()) {
-        sel = 'l';
-    }
-
     std::vector<double> b_norm = b;
     std::vector<double> a_norm = a;
 
@@ -237,38 +324,310 @@ void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector
         for (double &x : a_norm) x /= k;
     }
 
-    // Process left channel
-    if (sel == 'l' || sel == 'b') {
-        p.leftChannel = applyFiltfilt(p.leftChannel, b_norm, a_norm);
+    std::vector<float*> channels = p.channelData(selected);
+    filtfiltChannels(channels, p.storedFrames(), b_norm, a_norm, p.scratch);
+
+    std::cout << "Successfully applied filtfilt on " << describeChannels(selected, p.channels.size()) << "\n\n";
+}
+
+std::vector<float> applyFiltfilt(const std::vector<float>& input, const std::vector<double>& b, const std::vector<double>& a) {
+    std::vector<float> filteredChannel = input;
+
+    ScratchArena scratch;
+    applyFiltfilt(std::span(filteredChannel), b, a, scratch);
+
+    return filteredChannel;
+}
+
+void applyFiltfilt(std::span<float> samples, const std::vector<double>& b, const std::vector<double>& a, ScratchArena& scratch) {
+    float* channel = samples.data();
+    filtfiltChannels(std::span(&channel, 1), samples.size(), b, a, scratch);
+}
+
+void filtfiltChannels(std::span<float* const> channels, size_t n, const std::vector<double>& b, const std::vector<double>& a,
+                      ScratchArena& scratch) {
+    if (channels.empty() || n == 0) return;
+
+    std::vector<Biquad> sections = tf2sos(b, a);
+    ThreadPool& pool = ThreadPool::global();
+
+    // Odd extension at both ends, 2 * x[0] - x[j] before and 2 * x[n - 1] - x[n - 1 - j] after,
+    // so the edges start close to the steady state
+    const size_t pad = std::min(3 * (2 * sections.size() + 1), n - 1);
+    const size_t length = n + 2 * pad;
+
+    // Every sample of both buffers is written before it is read
+    ScratchArena::Scope scope(scratch);
+    std::vector<std::span<float>> extended, forward;
+    for (size_t c = 0; c < channels.size(); c++) {
+        extended.push_back(scratch.allocate<float>(length));
+        forward.push_back(scratch.allocate<float>(length));
+    }
+    std::vector<const float*> src, mid;
+    std::vector<float*> fwd, out;
+
+    for (size_t c = 0; c < channels.size(); c++) {
+        const float* x = channels[c];
+        float* ext = extended[c].data();
+
+        std::copy(x, x + n, ext + pad);
+        for (size_t j = 1; j <= pad; j++) {
+            ext[pad - j] = 2.0f * x[0] - x[j];
+            ext[pad + n - 1 + j] = 2.0f * x[n - 1] - x[n - 1 - j];
+        }
+
+        src.push_back(ext);
+        fwd.push_back(forward[c].data());
+        mid.push_back(forward[c].data());
+    }
+
+    // Segments run on their own threads once there are fewer channels than threads. Each one
+    // settles from a steady state estimate over enough samples for the transient to decay
+    // below SEGMENT_SETTLE_TOLERANCE, so the result matches the serial pass to within that
+    // relative error. Segment 0 starts from the exact edge conditions either way.
+    double radius = sosPoleRadius(sections);
+    size_t segments = 1, settle = 0;
+    if (pool.size() > channels.size() && radius < 1.0) {
+        settle = radius > 0.0 ? std::ceil(2.0 * std::log(SEGMENT_SETTLE_TOLERANCE) / std::log(radius)) : 0;
+        segments = std::min(pool.size(), length / std::max(MIN_SEGMENT_SAMPLES, 4 * settle));
+        segments = std::max<size_t>(segments, 1);
     }
 
-    // Process right channel
-    if (sel == 'r' || sel == 'b') {
-        p.rightChannel = applyFiltfilt(p.rightChannel, b_norm, a_norm);
+    auto bound = [&](size_t k) { return k * length / segments; };
+
+    // Block frames of each segment, shared by both passes
+    std::vector<std::span<double>> frames;
+    for (size_t k = 0; k < segments; k++) {
+        frames.push_back(scratch.allocate<double>(SOS_BLOCK_FRAMES * SosFilter::strideFor(channels.size())));
+    }
+
+    // Forward pass over the extended signal
+    pool.parallelFor(segments, [&](size_t k) {
+        sweepChannels(src, fwd, length, sections, bound(k), bound(k + 1), settle, false, frames[k]);
+    });
+
+    // Backward pass over the forward output, back into the extension buffers
+    for (size_t c = 0; c < channels.size(); c++) {
+        out.push_back(extended[c].data());
     }
+    pool.parallelFor(segments, [&](size_t k) {
+        sweepChannels(mid, out, length, sections, bound(k), bound(k + 1), settle, true, frames[k]);
+    });
 
-    std::cout << "Successfully applied filtfilt on ";
-    if (sel == 'l')
-        std::cout << "left channel\n\n";
-    else if (sel == 'r')
-        std::cout << "right channel\n\n";
-    else if (sel == 'b')
-        std::cout << "left and right channels\n\n";
+    for (size_t c = 0; c < channels.size(); c++) {
+        std::copy(extended[c].begin() + pad, extended[c].begin() + pad + n, channels[c]);
+    }
+}
+
+// Forward and backward pass of the band filters. Channels whose band buffers fit in
+// EQ_GROUP_BYTES run together, sharing banks with a lane per band of each channel. Bands are
+// split into as many groups as there are threads, and the channels of a pass into separate
+// banks only when threads are left over.
+static void iirEqualise(const std::vector<float*>& channels, size_t n, const std::vector<std::vector<Biquad>>& bands,
+                        const std::vector<float>& gains, ScratchArena& scratch) {
+    ThreadPool& pool = ThreadPool::global();
+
+    const size_t groups = std::min(pool.size(), EQ_BANDS);
+    const size_t concurrent = std::clamp<size_t>(EQ_GROUP_BYTES / (n * EQ_BANDS * sizeof(float)), 1, channels.size());
+    const size_t splits = std::min(concurrent, std::max<size_t>(pool.size() / groups, 1));
+
+    // Every band sample is written by the forward pass before it is read
+    ScratchArena::Scope scope(scratch);
+    std::vector<float*> outputs;
+    for (size_t c = 0; c < concurrent; c++) {
+        outputs.push_back(scratch.allocate<float>(n * EQ_BANDS).data());
+    }
+
+    for (size_t first = 0; first < channels.size(); first += concurrent) {
+        size_t count = std::min(concurrent, channels.size() - first);
+        size_t banks = std::min(splits, count);
+        auto bound = [&](size_t s) { return s * count / banks; };
+
+        pool.parallelFor(banks * groups, [&](size_t task) {
+            size_t s = task / groups;
+            size_t g = task % groups;
+
+            EqualiserBank bank(bands, g * EQ_BANDS / groups, (g + 1) * EQ_BANDS / groups, bound(s + 1) - bound(s));
+            bank.forward(channels.data() + first + bound(s), outputs.data() + bound(s), n);
+            bank.backward(outputs.data() + bound(s), n, gains);
+        });
+
+        // Reduction, each thread adding up a slice of samples
+        size_t slices = pool.size();
+        pool.parallelFor(count * slices, [&](size_t task) {
+            size_t c = task / slices;
+            size_t start = (task % slices) * n / slices;
+            size_t end = (task % slices + 1) * n / slices;
+
+            EqualiserBank::sumBands(outputs[c] + start, n, channels[first + c] + start, end - start);
+        });
+    }
+}
+
+
+// Samples until the slowest band's impulse response has decayed below the filtfilt segment tolerance
+static size_t equaliserTail(const std::vector<std::vector<Biquad>>& bands) {
+    double radius = 0.0;
+    for (const auto& band : bands) {
+        radius = std::max(radius, sosPoleRadius(band));
+    }
+    if (radius >= 1.0) {
+        throw std::runtime_error("Equaliser band filter is unstable\n");
+    }
+    return radius > 0.0 ? std::ceil(2.0 * std::log(SEGMENT_SETTLE_TOLERANCE) / std::log(radius)) : 1;
+}
+
+
+// Overlap-add blocks of the oddly extended channel multiplied by the zero-phase response.
+// The response's impulse response is cut off where it has decayed below the filtfilt
+// segment tolerance, and each FFT block leaves room for that much spill on both sides.
+static void fftEqualise(const std::vector<float*>& channels, size_t n, const std::vector<std::vector<Biquad>>& bands,
+                        const std::vector<float>& gains, ScratchArena& scratch) {
+    const size_t tail = equaliserTail(bands);
+
+    size_t fftSize = MIN_FFT_SIZE;
+    while (fftSize < 8 * tail) fftSize *= 2;
+    const size_t hop = fftSize - 2 * tail;
+
+    const RealFft fft(fftSize);
+    const std::vector<double> response = equaliserResponse(bands, gains, fftSize);
+
+    ThreadPool& pool = ThreadPool::global();
+    const size_t pad = std::min(tail, n - 1);
+    const size_t length = n + 2 * pad;
+    const size_t blocks = (length + hop - 1) / hop;
+
+    // One extension shared by the channels in turn, and a transform buffer for every thread
+    ScratchArena::Scope scope(scratch);
+    std::span<float> extended = scratch.allocate<float>(length);
+    std::vector<std::span<double>> frames;
+    std::vector<std::span<std::complex<double>>> spectra;
+    for (size_t w = 0; w < pool.size(); w++) {
+        frames.push_back(scratch.allocate<double>(fftSize));
+        spectra.push_back(scratch.allocate<std::complex<double>>(fftSize / 2 + 1));
+    }
+
+    for (float* channel : channels) {
+        std::copy(channel, channel + n, extended.begin() + pad);
+        for (size_t i = 0; i < pad; i++) {
+            extended[pad - 1 - i] = 2.0f * channel[0] - channel[i + 1];
+            extended[pad + n + i] = 2.0f * channel[n - 1] - channel[n - 2 - i];
+        }
+
+        // Block b writes to [b * hop - tail, (b + 1) * hop + tail), which only overlaps its
+        // neighbours as hop >= 2 * tail. Even blocks then odd blocks keep writes apart and the
+        // order of the additions fixed, whichever thread runs a block. Each thread takes a
+        // contiguous run of the blocks of one parity.
+        std::fill(channel, channel + n, 0.0f);
+        for (size_t parity = 0; parity < 2; parity++) {
+            const size_t tasks = (blocks + 1 - parity) / 2;
+            const size_t threads = pool.size();
+            pool.parallelFor(threads, [&](size_t w) {
+                std::span<double> frame = frames[w];
+                std::span<std::complex<double>> spectrum = spectra[w];
+
+                for (size_t task = w * tasks / threads; task < (w + 1) * tasks / threads; task++) {
+                    size_t start = (2 * task + parity) * hop;
+                    size_t count = std::min(hop, length - start);
+
+                    std::fill(frame.begin(), frame.end(), 0.0);
+                    std::copy(extended.begin() + start, extended.begin() + start + count, frame.begin());
+
+                    fft.forward(frame.data(), spectrum.data());
+                    for (size_t k = 0; k < spectrum.size(); k++) {
+                        spectrum[k] *= response[k];
+                    }
+                    fft.inverse(spectrum.data(), frame.data());
+
+                    // The response is zero phase, so output before the block start wraps to the end
+                    for (size_t i = 0; i < count + 2 * tail; i++) {
+                        ptrdiff_t position = static_cast<ptrdiff_t>(start + i) - static_cast<ptrdiff_t>(tail + pad);
+                        if (position < 0 || position >= static_cast<ptrdiff_t>(n)) continue;
+                        channel[position] += frame[(i + fftSize - tail) % fftSize];
+                    }
+                }
+            });
+        }
+    }
+}
+
+
+void equaliseChannels(const std::vector<float*>& channels, size_t n, const std::vector<std::vector<Biquad>>& bands,
+                      const std::vector<float>& gains, EqEngine engine, ScratchArena& scratch) {
+    if (bands.size() != EQ_BANDS || gains.size() != EQ_BANDS) {
+        throw std::runtime_error("Equaliser needs 5 band filters and gains\n");
+    }
+    if (n == 0) return;
+
+    if (engine == EqEngine::FFT) {
+        fftEqualise(channels, n, bands, gains, scratch);
+    } else {
+        iirEqualise(channels, n, bands, gains, scratch);
+    }
+}
+
+
+std::vector<double> equaliserResponse(const std::vector<std::vector<Biquad>>& bands, const std::vector<float>& gains, size_t fftSize) {
+    std::vector<double> response(fftSize / 2 + 1, 0.0);
+
+    for (size_t k = 0; k < response.size(); k++) {
+        std::complex<double> z1 = std::polar(1.0, -2.0 * M_PI * k / fftSize);     // z^(-1)
+        for (size_t band = 0; band < bands.size(); band++) {
+            std::complex<double> h = 1.0;
+            for (const Biquad& s : bands[band]) {
+                h *= (s.b0 + z1 * (s.b1 + z1 * s.b2)) / (1.0 + z1 * (s.a1 + z1 * s.a2));
+            }
+            // Same 0.7 band weighting as EqualiserBank::backward
+            response[k] += 0.7 * gains[band] * std::norm(h);
+        }
+    }
+
+    return response;
 }
 
-std::vector<int16_t> applyFiltfilt(const std::vector<int16_t>& input, const std::vector<double>& b, const std::vector<double>& a) {
-    std::vector<int16_t> forwardFiltered = applyFilter(input, b, a);
 
-    std::reverse(forwardFiltered.begin(), forwardFiltered.end());
+std::vector<float> causalEqualiserTaps(const std::vector<std::vector<Biquad>>& bands, const std::vector<float>& gains) {
+    if (bands.size() != EQ_BANDS || gains.size() != EQ_BANDS) {
+        throw std::runtime_error("Equaliser needs 5 band filters and gains\n");
+    }
+
+    // A long transform keeps the cepstrum from aliasing
+    const size_t tail = equaliserTail(bands);
+    size_t fftSize = MIN_FFT_SIZE;
+    while (fftSize < 8 * tail) fftSize *= 2;
+
+    const RealFft fft(fftSize);
+    std::vector<double> response = equaliserResponse(bands, gains, fftSize);
+
+    // Real cepstrum of the magnitude, floored so silenced bands stay finite
+    std::vector<std::complex<double>> spectrum(fftSize / 2 + 1);
+    for (size_t k = 0; k < spectrum.size(); k++) {
+        spectrum[k] = std::log(std::max(response[k], 1e-10));
+    }
+    std::vector<double> cepstrum(fftSize);
+    fft.inverse(spectrum.data(), cepstrum.data());
 
-    std::vector<int16_t> reverseFiltered = applyFilter(forwardFiltered, b, a);
+    // Folding the anti-causal half onto the causal half keeps the magnitude and makes the phase minimum
+    for (size_t i = 1; i < fftSize / 2; i++) {
+        cepstrum[i] *= 2.0;
+        cepstrum[fftSize - i] = 0.0;
+    }
 
-    std::reverse(reverseFiltered.begin(), reverseFiltered.end());
+    fft.forward(cepstrum.data(), spectrum.data());
+    for (std::complex<double>& bin : spectrum) {
+        bin = std::exp(bin);
+    }
+    std::vector<double> impulse(fftSize);
+    fft.inverse(spectrum.data(), impulse.data());
 
-    return reverseFiltered;
+    return std::vector<float>(impulse.begin(), impulse.begin() + std::min(tail, fftSize));
 }
 
-void equaliser(AudioProcessor& p, const std::vector<float>& gains, char sel) {
+
+void equaliser(AudioProcessor& p, const std::vector<float>& gains, ChannelMask sel, EqEngine engine) {
+    // Runs on the samples themselves, so deferred commands have to run first
+    p.evaluate();
+
     if (gains.size() != 5) {
         std::cerr << "Error: Equaliser needs 5 gains\n\n";
         return;
@@ -281,70 +640,186 @@ void equaliser(AudioProcessor& p, const std::vector<float>& gains, char sel) {
         }
     }
 
-    sel = tolower(sel);
-    if (sel != 'l' && sel != 'r' && sel != 'b') {
-        std::cerr << "Error: Invalid channel selection (l, r, or b) \n\n";
+    const ChannelMask selected = selectChannels(sel, p.channels.size());
+    if (!selected) {
         return;
     }
 
-    if (sel == 'r' && p.getRightChannel().empty()) {
-        std::cerr << "Audio is mono and does not have a right channel" << "\n\n";
-        return;
+    equaliseChannels(p.channelData(selected), p.storedFrames(), p.getEqualiserBands(), gains, engine, p.scratch);
+
+    std::cout << "Equalised " << describeChannels(selected, p.channels.size()) << " ";
+    std::cout << "with gains: ";
+    for (float g : gains) {
+        std::cout << g << " ";
+    }
+    if (engine == EqEngine::FFT) {
+        std::cout << "(FFT)";
+    }
+    std::cout << "\n\n";
+}
+
+EqualiserBank::EqualiserBank(const std::vector<std::vector<Biquad>>& bands, size_t firstBand, size_t lastBand, size_t numChannels)
+    : firstBand(firstBand), numBands(lastBand - firstBand), numChannels(numChannels) {
+    if (bands.size() != EQ_BANDS) {
+        throw std::runtime_error("Equaliser needs 5 band filters\n");
     }
 
-    if (sel == 'b' && p.getRightChannel().empty()) {
-        sel = 'l';
+    if (firstBand >= lastBand || lastBand > EQ_BANDS || numChannels == 0) {
+        throw std::runtime_error("Invalid equaliser band range\n");
     }
 
-    if (sel == 'l' || sel == 'b') {
-        // Cache leftChannel reference
-        auto& leftChannel = p.leftChannel;
+    // One lane per band of each channel, band k of channel c in lane c * numBands + k
+    std::vector<std::vector<Biquad>> lanes;
+    for (size_t c = 0; c < numChannels; c++) {
+        lanes.insert(lanes.end(), bands.begin() + firstBand, bands.begin() + lastBand);
+    }
+
+    forwardFilter = SosFilter(lanes);
+    backwardFilter = SosFilter(lanes);
+    frames.assign(SOS_BLOCK_FRAMES * forwardFilter.stride(), 0.0);
+}
 
-        std::vector<int16_t> accumulatedL(leftChannel.size(), 0);
+void EqualiserBank::reset() {
+    forwardFilter.reset();
+    backwardFilter.reset();
+}
 
-        for (size_t i = 0; i < gains.size(); i++) {
-            std::vector<int16_t> filteredL = applyFiltfilt(leftChannel, p.getB()[i], p.getA()[i]);
+void EqualiserBank::forward(const float* const* inputs, float* const* bands, size_t n) {
+    const size_t stride = forwardFilter.stride();
 
-            for (size_t j = 0; j < leftChannel.size(); j++) {
-                // 0.7 cause filter overlap causes higher gain when all 5 signals are added up
-                int32_t scaledSampleL = static_cast<int32_t>(filteredL[j]) * 0.7 * gains[i];
-                accumulatedL[j] += std::clamp(scaledSampleL, static_cast<int32_t>(INT16_MIN), static_cast<int32_t>(INT16_MAX));
+    for (size_t start = 0; start < n; start += SOS_BLOCK_FRAMES) {
+        size_t count = std::min(SOS_BLOCK_FRAMES, n - start);
+
+        // Every band of a channel filters the same sample
+        for (size_t i = 0; i < count; i++) {
+            for (size_t c = 0; c < numChannels; c++) {
+                std::fill_n(frames.begin() + i * stride + c * numBands, numBands, static_cast<double>(inputs[c][start + i]));
+            }
+        }
+
+        forwardFilter.process(frames.data(), frames.data(), count);
+
+        for (size_t c = 0; c < numChannels; c++) {
+            for (size_t k = 0; k < numBands; k++) {
+                const size_t lane = c * numBands + k;
+                float* band = bands[c] + (firstBand + k) * n + start;
+                for (size_t i = 0; i < count; i++) {
+                    band[i] = frames[i * stride + lane];
+                }
             }
         }
-        leftChannel = std::move(accumulatedL);
     }
+}
 
-    if (sel == 'r' || sel == 'b') {
-        auto& rightChannel = p.rightChannel;
+void EqualiserBank::backward(float* const* bands, size_t n, const std::vector<float>& gains) {
+    const size_t stride = backwardFilter.stride();
 
-        std::vector<int16_t> accumulatedR(rightChannel.size(), 0);
+    // 0.7 cause filter overlap causes higher gain when all 5 signals are added up
+    double weights[EQ_BANDS];
+    for (size_t k = 0; k < numBands; k++) {
+        weights[k] = 0.7 * gains[firstBand + k];
+    }
+
+    // From sample n - 1 to 0
+    for (size_t start = 0; start < n; start += SOS_BLOCK_FRAMES) {
+        size_t count = std::min(SOS_BLOCK_FRAMES, n - start);
+
+        for (size_t c = 0; c < numChannels; c++) {
+            for (size_t k = 0; k < numBands; k++) {
+                const size_t lane = c * numBands + k;
+                const float* band = bands[c] + (firstBand + k) * n + (n - 1 - start);
+                for (size_t i = 0; i < count; i++) {
+                    frames[i * stride + lane] = *(band - i);
+                }
+            }
+        }
 
-        for (size_t i = 0; i < gains.size(); i++) {
-            std::vector<int16_t> filteredR = applyFiltfilt(rightChannel, p.getB()[i], p.getA()[i]);
+        backwardFilter.process(frames.data(), frames.data(), count);
 
-            for (size_t j = 0; j < rightChannel.size(); j++) {
-                int32_t scaledSampleR = static_cast<int32_t>(filteredR[j]) * 0.7 * gains[i];
-                accumulatedR[j] += std::clamp(scaledSampleR, static_cast<int32_t>(INT16_MIN), static_cast<int32_t>(INT16_MAX));
+        for (size_t c = 0; c < numChannels; c++) {
+            for (size_t k = 0; k < numBands; k++) {
+                const size_t lane = c * numBands + k;
+                float* band = bands[c] + (firstBand + k) * n + (n - 1 - start);
+                for (size_t i = 0; i < count; i++) {
+                    *(band - i) = frames[i * stride + lane] * weights[k];
+                }
             }
         }
-        rightChannel = std::move(accumulatedR);
     }
+}
 
-    std::cout << "Equalised ";
-    if (sel == 'l')
-        std::cout << "left channel ";
-    else if (sel == 'r')
-        std::cout << "right channel ";
-    else if (sel == 'b')
-        std::cout << "left and right channels ";
-    
-    std::cout << "with gains: ";
-    for (float g : gains) {
-        std::cout << g << " ";
+void EqualiserBank::sumBands(const float* bands, size_t stride, float* output, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double accumulated = 0.0;
+        for (size_t k = 0; k < EQ_BANDS; k++) {
+            accumulated += bands[k * stride + i];
+        }
+        output[i] = accumulated;
     }
-    std::cout << "\n\n";
 }
 
+void convolve(AudioProcessor& p, const AudioProcessor& ir, ChannelMask sel, size_t blockSize) {
+    // Runs on the samples themselves, so deferred commands have to run first
+    p.evaluate();
+
+    if (ir.getNumChannels() == 0 || ir.getChannel(0).empty()) {
+        std::cerr << "Error: Impulse response is empty\n\n";
+        return;
+    }
+
+    if (ir.getHeader().sampleRate != p.getHeader().sampleRate) {
+        std::cerr << "Error: Impulse response is at " << ir.getHeader().sampleRate << " Hz but audio is at "
+                  << p.getHeader().sampleRate << " Hz\n\n";
+        return;
+    }
+
+    const ChannelMask selected = selectChannels(sel, p.channels.size());
+    if (!selected) {
+        return;
+    }
+
+    std::vector<std::shared_ptr<const IrSpectrum>> spectra = impulseResponseSpectra(ir, selected, p.channels.size(), blockSize);
+    if (spectra.empty()) {
+        return;
+    }
+
+    std::vector<std::shared_ptr<const IrSpectrum>> irs;
+    for (const auto& spectrum : spectra) {
+        if (spectrum) irs.push_back(spectrum);
+    }
+
+    convolveChannels(p.channelData(selected), p.storedFrames(), irs);
+
+    std::cout << "Convolved " << describeChannels(selected, p.channels.size()) << " ";
+    std::cout << "with a " << ir.getChannel(0).size() << " tap impulse response in "
+              << irs[0]->numPartitions() << " partitions of " << blockSize << "\n\n";
+}
+
+
+std::vector<std::shared_ptr<const IrSpectrum>> impulseResponseSpectra(const AudioProcessor& ir, ChannelMask selected, size_t numChannels,
+                                                                     size_t blockSize) {
+    const size_t irChannels = ir.getNumChannels();
+    std::vector<std::shared_ptr<const IrSpectrum>> spectra(numChannels);
+    std::shared_ptr<const IrSpectrum> shared;
+
+    for (size_t c = 0; c < numChannels; c++) {
+        if (!(selected >> c & 1)) continue;
+
+        if (irChannels == 1) {
+            if (!shared) shared = IrSpectrum::get(ir.getChannel(0), blockSize);
+            spectra[c] = shared;
+        } else if (c < irChannels) {
+            spectra[c] = IrSpectrum::get(ir.getChannel(c), blockSize);
+        } else {
+            std::cerr << "Error: Impulse response has " << irChannels << " channels and no channel " << c << "\n\n";
+            return {};
+        }
+    }
+
+    return spectra;
+}
+
+
 void dynamicCompression(AudioProcessor& p, float threshold, int ratio, float makeUpGain, float startDuration, float endDuration) {
     if (threshold < 0.0f || threshold > 1.0f) {
         std::cerr << "Error: Threshold must be between 0.0 and 1.0\n\n";
@@ -379,37 +854,17 @@ void dynamicCompression(AudioProcessor& p, float threshold, int ratio, float mak
     int startIndex = startDuration * p.header.sampleRate;
     int endIndex = endDuration * p.header.sampleRate;
 
-    int thresholdInt = threshold * INT16_MAX;
-    
-    for (size_t j = startIndex; j < endIndex; j++) {
-        int32_t compressedL = static_cast<int32_t>(p.leftChannel[j]);
-        
-        if (abs(compressedL) > thresholdInt) {
-            if (compressedL > 0)
-                compressedL = thresholdInt + (compressedL - thresholdInt) / ratio;
-            else
-                compressedL = -thresholdInt + (compressedL + thresholdInt) / ratio;
-        }
-        compressedL *= makeUpGain;
-
-        compressedL = std::clamp(compressedL, static_cast<int32_t>(INT16_MIN), static_cast<int32_t>(INT16_MAX));
-        p.leftChannel[j] = static_cast<int16_t>(compressedL);
-    }
-
-    if (p.getHeader().numChannels == 2) {
-        for (size_t j = startIndex; j < endIndex; j++) {
-            int32_t compressedR = static_cast<int32_t>(p.rightChannel[j]);
-
-            if (abs(compressedR) > thresholdInt) {
-                if (compressedR > 0)
-                    compressedR = thresholdInt + (compressedR - thresholdInt) / ratio;
-                else
-                    compressedR = -thresholdInt + (compressedR + thresholdInt) / ratio;
-            }
-            compressedR *= makeUpGain;
-
-            compressedR = std::clamp(compressedR, static_cast<int32_t>(INT16_MIN), static_cast<int32_t>(INT16_MAX));
-            p.rightChannel[j] = static_cast<int16_t>(compressedR);
+    if (AudioProcessor::getDeferred()) {
+        AudioProcessor::PendingOp op{AudioProcessor::PendingOp::Type::Compression, ALL_CHANNELS};
+        op.threshold = threshold;
+        op.ratio = ratio;
+        op.makeUpGain = makeUpGain;
+        p.defer(op, startIndex, endIndex);
+    } else {
+        auto [begin, end] = p.storedRange(startIndex, endIndex);
+
+        for (std::vector<float>& channel : p.channels) {
+            compressSamples(std::span(channel).subspan(begin, end - begin), threshold, ratio, makeUpGain);
         }
     }
   
@@ -420,11 +875,24 @@ void dynamicCompression(AudioProcessor& p, float threshold, int ratio, float mak
     std::cout << "[" << startIndex << " - " << endIndex << ")\n\n";
 }
 
-void reverseAudio(AudioProcessor& p) {
-    std::reverse(p.leftChannel.begin(), p.leftChannel.end());
+void compressSamples(std::span<float> samples, float threshold, int ratio, float makeUpGain) {
+    const float slope = 1.0f / ratio;
 
-    if (p.getHeader().numChannels == 2) 
-        std::reverse(p.rightChannel.begin(), p.rightChannel.end());
+    for (float& sample : samples) {
+        float compressed = sample;
+
+        if (compressed > threshold)
+            compressed = threshold + (compressed - threshold) * slope;
+        else if (compressed < -threshold)
+            compressed = -threshold + (compressed + threshold) * slope;
+
+        sample = compressed * makeUpGain;
+    }
+}
+
+void reverseAudio(AudioProcessor& p) {
+    // Only the view is reversed, later commands map their indices through it
+    p.viewReversed = !p.viewReversed;
 
     std::cout << "Successfully reversed audio \n\n";
 }
\ No newline at end of file
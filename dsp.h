@@ -2,25 +2,31 @@
 #define DSP_H
 
 #include <algorithm>
+#include <span>
 
 #include "audio.h"
+#include "sos.h"
+#include "fft.h"
+#include "conv.h"
+#include "pool.h"
+#include "arena.h"
 
 
 /// @brief Reduces total volumne of the whole file
 /// @param gain_dB -48.0f - 48.9f scale dB
-/// @param sel Channel selection: left 'L', right 'R' or both 'B'
+/// @param sel channels to process, eg. LEFT_CHANNEL or ALL_CHANNELS
 /// @param startDuration in seconds
 /// @param endDuration in seconds
-void volumeGain_dB(AudioProcessor& p, float gain_dB, char sel, float startDuration, float endDuration);
+void volumeGain_dB(AudioProcessor& p, float gain_dB, ChannelMask sel, float startDuration, float endDuration);
 
 
 /// @brief Reduces total volumne of the whole file
 /// @param p Reference to AudioProcessor object
 /// @param gain 0 - 255 scale
-/// @param sel Channel selection: left 'L', right 'R' or both 'B'
+/// @param sel channels to process, eg. LEFT_CHANNEL or ALL_CHANNELS
 /// @param startDuration in seconds
 /// @param endDuration in seconds
-void volumeGain(AudioProcessor& p, float gain, char sel, float startDuration, float endDuration);
+void volumeGain(AudioProcessor& p, float gain, ChannelMask sel, float startDuration, float endDuration);
 
 
 /// @brief Scales input data based on gain
@@ -29,15 +35,31 @@ void volumeGain(AudioProcessor& p, float gain, char sel, float startDuration, fl
 /// @return vector of scaled data 
 /// @param startIndex inclusive
 /// @param endIndex not inclusive
-std::vector<int16_t> applyVolumeGain(const std::vector<int16_t>& input, float gain, int startIndex, int endIndex);
+std::vector<float> applyVolumeGain(const std::vector<float>& input, float gain, int startIndex, int endIndex);
+
+
+/// @brief Scales samples [startIndex, endIndex) in place, touching only that range and
+/// never allocating
+/// @param samples channel to scale
+/// @param gain 0 - 255 scale
+/// @param startIndex inclusive
+/// @param endIndex not inclusive
+/// @return false if the gain or range is invalid
+bool applyVolumeGain(std::span<float> samples, float gain, size_t startIndex, size_t endIndex);
+
+
+/// @brief Scales samples in place, levels above full scale saturate on write
+/// @param samples samples to scale
+/// @param gain 0 - 255 scale
+void scaleSamples(std::span<float> samples, float gain);
 
 
 /// @brief Filters all channels of AudioProcessor object
 /// @param p Reference to AudioProcessor object
 /// @param b Numerator Coefficents {b0, b1, b2, ...}
 /// @param a Denominator Coefficents {1, a1, a2, a3, ...}
-/// @param sel Channel selection: left 'L', right 'R' or both 'B'
-void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, char sel);
+/// @param sel channels to process, eg. LEFT_CHANNEL or ALL_CHANNELS
+void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, ChannelMask sel);
 
 
 /// @brief Filters data based on the filter coefficients
@@ -45,15 +67,48 @@ void filter(AudioProcessor& p, const std::vector<double>& b, const std::vector<d
 /// @param b Numerator Coefficents {b0, b1, b2, ...}
 /// @param a Denominator Coefficents {1, a1, a2, a3, ...}
 /// @return vector of filtered data 
-std::vector<int16_t> applyFilter(const std::vector<int16_t>& input, const std::vector<double>& b, const std::vector<double>& a);
+std::vector<float> applyFilter(const std::vector<float>& input, const std::vector<double>& b, const std::vector<double>& a);
+
+
+/// @brief Filters samples in place based on the filter coefficients
+/// @param samples data to filter
+/// @param b Numerator Coefficents {b0, b1, b2, ...}
+/// @param a Denominator Coefficents {1, a1, a2, a3, ...}
+/// @param scratch working memory, given back when the call returns
+void applyFilter(std::span<float> samples, const std::vector<double>& b, const std::vector<double>& a, ScratchArena& scratch);
+
+
+/// @brief Filters equal length channels in place through a cascade of second-order sections,
+/// one channel per SIMD lane
+/// @param channels samples of each channel
+/// @param n number of samples per channel
+/// @param b Numerator Coefficents {b0, b1, b2, ...}
+/// @param a Denominator Coefficents {1, a1, a2, a3, ...}
+/// @param backward filter from the last sample to the first
+/// @param scratch working memory, given back when the call returns
+void filterChannels(std::span<float* const> channels, size_t n, const std::vector<double>& b, const std::vector<double>& a,
+                    bool backward, ScratchArena& scratch);
+
+
+/// @brief Zero-phase filters equal length channels in place. The ends are extended by odd
+/// reflection and each pass starts from the filter's steady state for its first sample, like
+/// scipy's filtfilt with lfilter_zi. Long channels are split into segments across the global
+/// pool, matching the serial result to within a relative error of about 1e-9.
+/// @param channels samples of each channel
+/// @param n number of samples per channel
+/// @param b Numerator Coefficents {b0, b1, b2, ...}
+/// @param a Denominator Coefficents {1, a1, a2, a3, ...}
+/// @param scratch working memory, given back when the call returns
+void filtfiltChannels(std::span<float* const> channels, size_t n, const std::vector<double>& b, const std::vector<double>& a,
+                      ScratchArena& scratch);
 
 
 /// @brief Zero-phase filtering of all channels of AudioProcessor object
 /// @param p Reference to AudioProcessor object
 /// @param b Numerator Coefficents {b0, b1, b2, ...}
 /// @param a Denominator Coefficents {1, a1, a2, a3, ...}
-/// @param sel Channel selection: left 'L', right 'R' or both 'B'
-void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, char sel);
+/// @param sel channels to process, eg. LEFT_CHANNEL or ALL_CHANNELS
+void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector<double>& a, ChannelMask sel);
 
 
 /// @brief Zero-phase filtering based on the filter coefficients
@@ -61,14 +116,131 @@ void filtfilt(AudioProcessor& p, const std::vector<double>& b, const std::vector
 /// @param b Numerator Coefficents {b0, b1, b2, ...}
 /// @param a Denominator Coefficents {1, a1, a2, a3, ...}
 /// @return vector of filtered data 
-std::vector<int16_t> applyFiltfilt(const std::vector<int16_t>& input, const std::vector<double>& b, const std::vector<double>& a);
+std::vector<float> applyFiltfilt(const std::vector<float>& input, const std::vector<double>& b, const std::vector<double>& a);
+
+
+/// @brief Zero-phase filters samples in place based on the filter coefficients
+/// @param samples data to filter
+/// @param b Numerator Coefficents {b0, b1, b2, ...}
+/// @param a Denominator Coefficents {1, a1, a2, a3, ...}
+/// @param scratch working memory, given back when the call returns
+void applyFiltfilt(std::span<float> samples, const std::vector<double>& b, const std::vector<double>& a, ScratchArena& scratch);
+
+
+// Equaliser implementation
+//   IIR: forward and backward pass of each band filter, zero phase by running it twice
+//   FFT: one multiply per bin by the same zero-phase response, in overlap-add blocks
+enum class EqEngine { IIR, FFT };
 
 
 /// @brief Applies 5 gains to the preset 5 equaliser filters
 /// @param p Reference to AudioProcessor object
 /// @param gains 5 gains for Sub-Bass, Bass, Midrange, Upper Midrange, Treble
-/// @param sel Channel selection: left 'L', right 'R' or both 'B'
-void equaliser(AudioProcessor& p, const std::vector<float>& gains, char sel);
+/// @param sel channels to process, eg. LEFT_CHANNEL or ALL_CHANNELS
+/// @param engine equaliser implementation
+void equaliser(AudioProcessor& p, const std::vector<float>& gains, ChannelMask sel, EqEngine engine = EqEngine::IIR);
+
+
+// Number of equaliser bands
+constexpr size_t EQ_BANDS = 5;
+
+
+/// @brief Equalises equal length channels in place with the global pool
+/// @param channels samples of each channel
+/// @param n number of samples per channel
+/// @param bands sections of each band filter, eg. from designBands
+/// @param gains 5 band gains, 0 - 255 scale
+/// @param engine equaliser implementation
+/// @param scratch working memory, given back when the call returns
+void equaliseChannels(const std::vector<float*>& channels, size_t n, const std::vector<std::vector<Biquad>>& bands,
+                      const std::vector<float>& gains, EqEngine engine, ScratchArena& scratch);
+
+
+/// @brief Zero-phase response of the equaliser, the weighted sum of |H(e^jw)|^2 of each band,
+/// which is what the forward and backward passes of the IIR engine apply
+/// @param bands sections of each band filter
+/// @param gains 5 band gains, 0 - 255 scale
+/// @param fftSize real FFT length the response is sampled for
+/// @return fftSize / 2 + 1 real gains, from DC to Nyquist
+std::vector<double> equaliserResponse(const std::vector<std::vector<Biquad>>& bands, const std::vector<float>& gains, size_t fftSize);
+
+
+/// @brief Equaliser band filters run together in one sweep per direction, one band of one channel
+/// per SIMD lane, so channels sharing a bank fill the vectors a single channel's bands leave empty.
+/// Band outputs are planar, band k of sample i at bands[k * n + i], so banks covering different
+/// bands of the same channel can run on different threads.
+class EqualiserBank {
+public:
+    /// @param bands sections of each band filter, eg. from designBands
+    /// @param firstBand first band filtered by this bank
+    /// @param lastBand one past the last band filtered by this bank
+    /// @param numChannels channels filtered side by side
+    EqualiserBank(const std::vector<std::vector<Biquad>>& bands, size_t firstBand = 0, size_t lastBand = EQ_BANDS,
+                  size_t numChannels = 1);
+
+    /// @brief Clears the filter history of both directions
+    void reset();
+
+    /// @brief Forward sweep, filters a block of each channel through the bank's bands
+    /// @param inputs data to filter, one per channel
+    /// @param bands planar band outputs of each channel, n * EQ_BANDS, only the bank's bands are written
+    /// @param n number of samples per channel
+    void forward(const float* const* inputs, float* const* bands, size_t n);
+
+    /// @brief Backward sweep from the last sample of the block to the first, replacing each
+    /// of the bank's band outputs with its weighted, filtered value
+    /// @param bands planar forward sweep band outputs of each channel, n * EQ_BANDS
+    /// @param n number of samples per channel
+    /// @param gains 5 band gains, 0 - 255 scale
+    void backward(float* const* bands, size_t n, const std::vector<float>& gains);
+
+    /// @brief Reduction of the weighted bands, adding them up in band order so the result
+    /// does not depend on how the bands were split between banks
+    /// @param bands planar weighted band outputs, band k of sample i at bands[k * stride + i]
+    /// @param stride distance between bands, the number of samples in the bands buffer
+    /// @param output equalised data
+    /// @param n number of samples to add up
+    static void sumBands(const float* bands, size_t stride, float* output, size_t n);
+
+private:
+    size_t firstBand;
+    size_t numBands;
+    size_t numChannels;
+
+    SosFilter forwardFilter;
+    SosFilter backwardFilter;
+
+    std::vector<double> frames;     // Block of frames in the SosFilter lane layout
+};
+
+
+/// @brief Causal equaliser for live streams, where the backward pass of filtfilt is not
+/// possible. A minimum phase FIR with the magnitude response of the zero-phase equaliser,
+/// found through the real cepstrum of equaliserResponse, to run with a Convolver.
+/// @param bands sections of each band filter, eg. from designBands
+/// @param gains 5 band gains, 0 - 255 scale
+/// @return taps, long enough for the response to decay like the band filters
+std::vector<float> causalEqualiserTaps(const std::vector<std::vector<Biquad>>& bands, const std::vector<float>& gains);
+
+
+/// @brief Convolves channels with an impulse response, eg. a room or speaker correction.
+/// A mono impulse response applies to every selected channel, a multichannel one channel by channel.
+/// @param p Reference to AudioProcessor object
+/// @param ir impulse response at the same sample rate
+/// @param sel channels to process, eg. LEFT_CHANNEL or ALL_CHANNELS
+/// @param blockSize samples per partition, a power of 2
+void convolve(AudioProcessor& p, const AudioProcessor& ir, ChannelMask sel, size_t blockSize);
+
+
+/// @brief Spectra of an impulse response for each selected channel, the mono one shared by all
+/// @param ir impulse response, mono or with a channel for each selected one
+/// @param selected resolved channel selection, eg. from selectChannels
+/// @param numChannels channels of the audio it applies to
+/// @param blockSize samples per partition, a power of 2
+/// @return one spectrum per channel, nullptr for the unselected ones, empty if the impulse
+/// response lacks a selected channel
+std::vector<std::shared_ptr<const IrSpectrum>> impulseResponseSpectra(const AudioProcessor& ir, ChannelMask selected, size_t numChannels,
+                                                                     size_t blockSize);
 
 
 /// @brief Applies dynamic range compression to all audio channels
@@ -80,6 +252,13 @@ void equaliser(AudioProcessor& p, const std::vector<float>& gains, char sel);
 /// @param endDuration in seconds
 void dynamicCompression(AudioProcessor& p, float threshold, int ratio, float makeUpGain, float startDuration, float endDuration);
 
+/// @brief Compresses samples in place
+/// @param samples samples to compress
+/// @param threshold 0.0f - 1.0f, level above which to apply gain reduction
+/// @param ratio >= 1, degree of compression
+/// @param makeUpGain 1.0f - 3.0f, whole signal gain to bring output level back up
+void compressSamples(std::span<float> samples, float threshold, int ratio, float makeUpGain);
+
 /// @brief Reverses the entire audio
 /// @param p Reference to AudioProcessor object
 void reverseAudio(AudioProcessor& p);
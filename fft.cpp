@@ -0,0 +1,114 @@
+#include "fft.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+using Complex = std::complex<double>;
+
+
+RealFft::RealFft(size_t size) : n(size) {
+    if (size < 4 || (size & (size - 1)) != 0) {
+        throw std::runtime_error("FFT size must be a power of 2 of at least 4\n");
+    }
+
+    const size_t m = n / 2;
+
+    reversed.resize(m);
+    size_t bits = 0;
+    while ((size_t(1) << bits) < m) bits++;
+    for (size_t i = 0; i < m; i++) {
+        size_t r = 0;
+        for (size_t b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        reversed[i] = r;
+    }
+
+    twiddles.resize(m / 2);
+    for (size_t k = 0; k < m / 2; k++) {
+        twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / m);
+    }
+
+    split.resize(m + 1);
+    for (size_t k = 0; k <= m; k++) {
+        split[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+    }
+}
+
+
+void RealFft::complexFft(Complex* data, bool inverse) const {
+    const size_t m = n / 2;
+
+    for (size_t i = 0; i < m; i++) {
+        if (i < reversed[i]) std::swap(data[i], data[reversed[i]]);
+    }
+
+    // Iterative radix-2 butterflies, the twiddle of span len is every (m / len)th entry
+    for (size_t len = 2; len <= m; len *= 2) {
+        const size_t half = len / 2;
+        const size_t step = m / len;
+        for (size_t start = 0; start < m; start += len) {
+            for (size_t j = 0; j < half; j++) {
+                Complex w = inverse ? std::conj(twiddles[j * step]) : twiddles[j * step];
+                Complex u = data[start + j];
+                Complex v = data[start + j + half] * w;
+                data[start + j] = u + v;
+                data[start + j + half] = u - v;
+            }
+        }
+    }
+}
+
+
+void RealFft::forward(const double* input, Complex* output) const {
+    const size_t m = n / 2;
+
+    // Even samples as the real part, odd samples as the imaginary part
+    for (size_t k = 0; k < m; k++) {
+        output[k] = Complex(input[2 * k], input[2 * k + 1]);
+    }
+    complexFft(output, false);
+
+    // Untangle the spectra of the even and odd samples, X = E + W^k O
+    Complex z0 = output[0];
+    output[0] = z0.real() + z0.imag();
+    output[m] = z0.real() - z0.imag();
+
+    for (size_t k = 1; k <= m / 2; k++) {
+        Complex zk = output[k];
+        Complex zmk = std::conj(output[m - k]);
+
+        Complex even = 0.5 * (zk + zmk);
+        Complex odd = Complex(0.0, -0.5) * (zk - zmk);
+
+        output[k] = even + split[k] * odd;
+        output[m - k] = std::conj(even - split[k] * odd);
+    }
+}
+
+
+void RealFft::inverse(Complex* input, double* output) const {
+    const size_t m = n / 2;
+
+    // Reverse of the untangling in forward, packing E + i O into a half size spectrum
+    for (size_t k = 0; k <= m / 2; k++) {
+        Complex xk = input[k];
+        Complex xmk = std::conj(input[m - k]);
+
+        Complex even = 0.5 * (xk + xmk);
+        Complex odd = 0.5 * (xk - xmk) * std::conj(split[k]);
+
+        input[k] = even + Complex(0.0, 1.0) * odd;
+        if (k != 0 && k != m - k) {
+            input[m - k] = std::conj(even) + Complex(0.0, 1.0) * std::conj(odd);
+        }
+    }
+    complexFft(input, true);
+
+    const double scale = 1.0 / m;
+    for (size_t k = 0; k < m; k++) {
+        output[2 * k] = input[k].real() * scale;
+        output[2 * k + 1] = input[k].imag() * scale;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+
+/// @brief Real-input FFT of a fixed power of 2 size, computed as a half size complex FFT.
+/// Transforms only read the precomputed tables, so one plan can be shared between threads.
+class RealFft {
+public:
+    /// @param size transform length, a power of 2 >= 4
+    explicit RealFft(size_t size);
+
+    /// @brief Spectrum of a real signal
+    /// @param input size samples
+    /// @param output size / 2 + 1 bins, from DC to Nyquist
+    void forward(const double* input, std::complex<double>* output) const;
+
+    /// @brief Real signal of a spectrum, scaled by 1 / size so it inverts forward
+    /// @param input size / 2 + 1 bins, modified as scratch
+    /// @param output size samples
+    void inverse(std::complex<double>* input, double* output) const;
+
+    size_t size() const { return n; }
+
+private:
+    // In-place complex FFT of n / 2 points, bit reversed input order handled inside
+    void complexFft(std::complex<double>* data, bool inverse) const;
+
+    size_t n;
+    std::vector<size_t> reversed;               // Bit reversal permutation of n / 2 points
+    std::vector<std::complex<double>> twiddles; // exp(-2 pi i k / (n / 2)), k < n / 4
+    std::vector<std::complex<double>> split;    // exp(-2 pi i k / n), k <= n / 2
+};
+
+#endif
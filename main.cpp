@@ -11,6 +11,11 @@
 #include <cstdint>
 
 #include "audio.h"
+#include "stream.h"
+#include "batch.h"
+#include "sos.h"
+#include "pool.h"
+#include "profile.h"
 
 
 #define MAX 1024
@@ -24,8 +29,14 @@ void runTrimCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv)
 
 void runGainCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
 void runEqualiseCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
+void runConvolveCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
 void runDynamicCompressionCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
 void runReverseCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
+void runStreamCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
+void runStatsCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv);
+
+int runPipe(int argc, char* argv[]);
+int runBatch(int argc, char* argv[]);
 
 
 struct Command {
@@ -36,19 +47,24 @@ struct Command {
 };
 
 static bool ECHO = false;
+static bool TIMING = false;
 static Command* currCommand = nullptr;
+static Profiler PROFILER;
 
 static std::vector<Command> COMMANDS = {
-    {"r", runReadFileCommand, "[input.wav]", "reads 16 bit .wav file"},
+    {"r", runReadFileCommand, "[input.wav]", "reads 8, 16, 24 or 32 bit PCM or 32 bit float .wav file"},
     {"w", runWriteFileCommand, "[output.wav]", "writes result to .wav file"},
     {"h", runPrintHeaderCommand, "", "prints header information of the .wav file"},
-    {"p", runPrintTxtCommand, "[output.txt]", "prints audio data to .txt file"},
+    {"p", runPrintTxtCommand, "[output.txt]", "prints audio data to .txt file, or to .csv with a time column"},
     {"t", runTrimCommand, "start [end]", "trims audio, cutoff in seconds"},
     
-    {"g", runGainCommand, "g0 [sel] [start] [end]", "adds gain to audio data, sel = 'l', 'r', or 'b', cutoff in seconds"},
-    {"eq", runEqualiseCommand, "g0 g1 g2 g3 g4 [sel]", "equalises based on 5 gains, sel = 'l', 'r', or 'b'"},
+    {"g", runGainCommand, "g0 [sel] [start] [end]", "adds gain to audio data, sel = l, r, b or channel list eg. 0,2, cutoff in seconds"},
+    {"eq", runEqualiseCommand, "g0 g1 g2 g3 g4 [sel] [engine]", "equalises based on 5 gains, sel = l, r, b or channel list eg. 0,2, engine = iir or fft"},
+    {"ir", runConvolveCommand, "ir.wav [sel]", "convolves with an impulse response .wav file, sel = l, r, b or channel list eg. 0,2"},
     {"drc", runDynamicCompressionCommand, "[thres] [ratio] [gain] [start] [end]", "dynamic compression: [threshold], [ratio], [gain], cutoff in seconds"},
     {"rev", runReverseCommand, "", "reverses audio"},
+    {"s", runStreamCommand, "input.wav output.wav [chain]", "streams file block by block through chain, eg. g 2 ; eq 1 1 2 1 1 ; drc"},
+    {"stats", runStatsCommand, "", "prints time, samples, allocations and clipping of each command so far"},
 
     {"?", nullptr, "", "show this message"},
     {"q", nullptr, "", "quit"}
@@ -62,6 +78,99 @@ void showHelp() {
     std::cout << '\n';
 }
 
+int runPipe(int argc, char* argv[]) {
+    uint32_t sampleRate = 44100;
+    uint16_t channels = 2;
+    size_t blockSize = DEFAULT_PIPE_BLOCK_SIZE;
+    std::string controlFile;
+
+    int i = 0;
+    try {
+        for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+            std::string arg = argv[i];
+            if (arg == "--control") {
+                controlFile = argv[i + 1];
+                continue;
+            }
+
+            int value = std::stoi(argv[i + 1]);
+            if (value < 1) throw std::invalid_argument(arg);
+
+            if (arg == "-r") {
+                sampleRate = value;
+            } else if (arg == "-c") {
+                channels = value;
+            } else if (arg == "-b") {
+                blockSize = value;
+            } else {
+                std::cerr << "Error: Unknown stream option " << arg << "\n\n";
+                return EXIT_FAILURE;
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: Invalid value for stream option " << argv[i] << "\n\n";
+        return EXIT_FAILURE;
+    }
+
+    StreamProcessor stream(blockSize);
+    if (!stream.addChain(std::vector<std::string>(argv + i, argv + argc))) {
+        return EXIT_FAILURE;
+    }
+
+    return stream.processPipe(stdin, stdout, sampleRate, channels, controlFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int runBatch(int argc, char* argv[]) {
+    std::string outputDir;
+    std::string listFile;
+
+    int i = 0;
+    for (; i + 1 < argc && argv[i][0] == '-' && std::string(argv[i]) != "--"; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "-o") {
+            outputDir = argv[i + 1];
+        } else if (arg == "-l") {
+            listFile = argv[i + 1];
+        } else {
+            std::cerr << "Error: Unknown batch option " << arg << "\n\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (outputDir.empty()) {
+        std::cerr << "Error: Batch needs an output directory, -o DIR\n\n";
+        return EXIT_FAILURE;
+    }
+
+    // Chain up to "--", the files after it
+    int separator = i;
+    while (separator < argc && std::string(argv[separator]) != "--") separator++;
+
+    BatchProcessor batch(outputDir);
+    if (!batch.addChain(std::vector<std::string>(argv + i, argv + separator))) {
+        return EXIT_FAILURE;
+    }
+
+    if (!listFile.empty() && !batch.addFileList(listFile)) {
+        return EXIT_FAILURE;
+    }
+
+    bool anyFiles = !listFile.empty();
+    for (int f = separator + 1; f < argc; f++) {
+        if (!batch.addFiles(argv[f])) {
+            return EXIT_FAILURE;
+        }
+        anyFiles = true;
+    }
+
+    if (!anyFiles) {
+        std::cerr << "Error: No files to process, pass them after -- or with -l LIST\n\n";
+        return EXIT_FAILURE;
+    }
+
+    return batch.process() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 void processOptions(int argc, char* argv[]) {
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -69,10 +178,48 @@ void processOptions(int argc, char* argv[]) {
             std::cout << "Usage: " << argv[0] << " [options]...\n"
                  << "Options:\n"
                  << "    -h      show this help message\n"
-                 << "    -e      echo - echo all commands\n";
+                 << "    -e      echo - echo all commands\n"
+                 << "    -t      timing - print the time, samples, allocations and clipping of each command\n"
+                 << "    -s      scalar - use the scalar reference filter and sample conversion kernels instead of "
+                 << SosFilter::kernelName(SosFilter::getKernel()) << "\n"
+                 << "    -j N    jobs - run filters on N threads (default 1)\n"
+                 << "    -d      deferred - queue g and drc and run them in one pass when the audio is written\n"
+                 << "    --stream [-r RATE] [-c CHANNELS] [-b FRAMES] [--control FILE] chain\n"
+                 << "            stream raw 16-bit PCM from stdin through chain to stdout, eg. g 2 ; eq 1 1 2 1 1 ; drc\n"
+                 << "            g, eq and drc lines written to the control FILE or named pipe change the chain live\n"
+                 << "            (default 44100 Hz, 2 channels, blocks of " << DEFAULT_PIPE_BLOCK_SIZE << " frames)\n"
+                 << "    --batch -o DIR [-l LIST] chain -- files...\n"
+                 << "            run chain over files or quoted patterns, eg. 'audio/*.wav', writing them to DIR\n"
+                 << "            files run in parallel with -j N given before --batch\n";
             exit(EXIT_SUCCESS);
         } else if (arg == "-e") {
             ECHO = true;
+        } else if (arg == "-t") {
+            TIMING = true;
+        } else if (arg == "-d") {
+            AudioProcessor::setDeferred(true);
+        } else if (arg == "-s") {
+            SosFilter::setKernel(SosFilter::Kernel::Scalar);
+            setPcmVectorKernels(false);
+        } else if (arg == "-j") {
+            int numThreads = 0;
+            try {
+                numThreads = i + 1 < argc ? std::stoi(argv[++i]) : 0;
+            } catch (std::exception& e) {
+                numThreads = 0;
+            }
+
+            if (numThreads < 1) {
+                std::cerr << "Error: -j needs a thread count of at least 1\n\n";
+                exit(EXIT_FAILURE);
+            }
+            ThreadPool::setGlobalThreads(numThreads);
+        } else if (arg == "--stream") {
+            // Everything after --stream configures the pipe
+            exit(runPipe(argc - i - 1, argv + i + 1));
+        } else if (arg == "--batch") {
+            // Everything after --batch configures the batch
+            exit(runBatch(argc - i - 1, argv + i + 1));
         }
     }
 }
@@ -136,8 +283,15 @@ int main(int argc, char* argv[]) {
                 if (cmdName == command.code) {
                     validCommand = true;
                     currCommand = &command;
-                    if (command.fn) {
+                    if (command.fn == runStatsCommand) {
+                        command.fn(p1, tokens.size(), tokens);
+                    } else if (command.fn) {
+                        PROFILER.begin(p1.getNumSamples());
                         command.fn(p1, tokens.size(), tokens);
+                        Profiler::Counters run = PROFILER.end(command.code, p1.getNumSamples());
+                        if (TIMING) {
+                            Profiler::printRun(std::cout, command.code, run);
+                        }
                     }
                     break;
                 }
@@ -177,7 +331,7 @@ void runReadFileCommand(AudioProcessor& p, int argc, std::vector<std::string>& a
 }
 
 void runWriteFileCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first! " << "\n\n";
         return;
     }
@@ -195,7 +349,7 @@ void runWriteFileCommand(AudioProcessor& p, int argc, std::vector<std::string>&
 }
 
 void runPrintHeaderCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first! " << "\n\n";
         return;
     }
@@ -203,7 +357,7 @@ void runPrintHeaderCommand(AudioProcessor& p, int argc, std::vector<std::string>
 }
 
 void runPrintTxtCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first! " << "\n\n";
         return;
     }
@@ -213,7 +367,9 @@ void runPrintTxtCommand(AudioProcessor& p, int argc, std::vector<std::string>& a
         std::string outputFile = "audio/rawDump.txt";
         p.writeOutputTxt(outputFile);
     } else if (argc == 2) {
-        p.writeOutputTxt(argv[1]);
+        const std::string& outputFile = argv[1];
+        bool csv = outputFile.size() >= 4 && outputFile.compare(outputFile.size() - 4, 4, ".csv") == 0;
+        p.writeOutputTxt(outputFile, csv);
     } else {
         std::cout << "Usage: p output.txt" << "\n\n";
         return;
@@ -221,7 +377,7 @@ void runPrintTxtCommand(AudioProcessor& p, int argc, std::vector<std::string>& a
 }
 
 void runTrimCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first! " << "\n\n";
         return;
     }
@@ -258,7 +414,7 @@ void runGainCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv)
         return;
     }
 
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first! " << "\n\n";
         return;
     }
@@ -271,8 +427,8 @@ void runGainCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv)
         return;
     }
 
-    char sel = 'b';
-    if (argc >= 3) sel = tolower(argv[2][0]);
+    ChannelMask sel = ALL_CHANNELS;
+    if (argc >= 3 && !parseChannelMask(argv[2], sel)) return;
 
     float startDuration = 0.0f;
     if (argc >= 4) {
@@ -298,18 +454,28 @@ void runGainCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv)
 }
 
 void runEqualiseCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
-    if (argc != 6 && argc != 7) {
-        std::cout << "Usage: eq g0 g1 g2 g3 g4 [sel]" << "\n\n";
+    if (argc < 6 || argc > 8) {
+        std::cout << "Usage: eq g0 g1 g2 g3 g4 [sel] [engine]" << "\n\n";
         return;
     }
 
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first!" << "\n\n";
         return;
     }
 
-    char sel = 'b';
-    if (argc == 7) sel = tolower(argv[6][0]);
+    // Channel selection and engine, either can be left out
+    ChannelMask sel = ALL_CHANNELS;
+    EqEngine engine = EqEngine::IIR;
+    for (int i = 6; i < argc; i++) {
+        if (argv[i] == "fft") {
+            engine = EqEngine::FFT;
+        } else if (argv[i] == "iir") {
+            engine = EqEngine::IIR;
+        } else if (!parseChannelMask(argv[i], sel)) {
+            return;
+        }
+    }
 
     std::vector<float> gains;
     for (int i = 1; i < 6; i++) {
@@ -321,7 +487,30 @@ void runEqualiseCommand(AudioProcessor& p, int argc, std::vector<std::string>& a
             return;
         }
     }
-    equaliser(p, gains, sel);
+    equaliser(p, gains, sel, engine);
+}
+
+void runConvolveCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
+    if (argc != 2 && argc != 3) {
+        std::cout << "Usage: ir ir.wav [sel]" << "\n\n";
+        return;
+    }
+
+    if (p.empty()) {
+        std::cout << "Read in audio file with command \"r\" first!" << "\n\n";
+        return;
+    }
+
+    ChannelMask sel = ALL_CHANNELS;
+    if (argc == 3 && !parseChannelMask(argv[2], sel)) return;
+
+    // Partitions of the same size as streamed blocks
+    try {
+        AudioProcessor ir(argv[1]);
+        convolve(p, ir, sel, DEFAULT_STREAM_BLOCK_SIZE);
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n\n";
+    }
 }
 
 void runDynamicCompressionCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
@@ -330,7 +519,7 @@ void runDynamicCompressionCommand(AudioProcessor& p, int argc, std::vector<std::
         return;
     }
 
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first!" << "\n\n";
         return;
     }
@@ -390,9 +579,36 @@ void runDynamicCompressionCommand(AudioProcessor& p, int argc, std::vector<std::
 
 
 void runReverseCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
-    if (p.getLeftChannel().empty()) {
+    if (p.empty()) {
         std::cout << "Read in audio file with command \"r\" first!" << "\n\n";
         return;
     }
     reverseAudio(p);
-}
\ No newline at end of file
+}
+
+void runStreamCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
+    if (argc < 3) {
+        std::cout << "Usage: s input.wav output.wav [chain]" << "\n\n";
+        return;
+    }
+
+    try {
+        StreamProcessor stream;
+        std::vector<std::string> chain(argv.begin() + 3, argv.end());
+        if (!stream.addChain(chain)) {
+            return;
+        }
+
+        stream.process(argv[1], argv[2]);
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n\n";
+    }
+}
+
+void runStatsCommand(AudioProcessor& p, int argc, std::vector<std::string>& argv) {
+    PROFILER.print(std::cout);
+
+    const ScratchArena& scratch = p.getScratch();
+    std::cout << "Scratch: " << scratch.highWaterMark() << " bytes at most, " << scratch.capacity() << " bytes held, "
+              << scratch.blockAllocations() << " block allocations\n\n";
+}
@@ -0,0 +1,48 @@
+#include "mapped.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file: " + path + "\n");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            // Samples are read once from start to end
+            madvise(address, info.st_size, MADV_SEQUENTIAL);
+            mapped = static_cast<const char*>(address);
+            length = info.st_size;
+            close(fd);
+            return;
+        }
+    }
+
+    // Not mappable, read it all
+    char block[1 << 16];
+    ssize_t count;
+    while ((count = read(fd, block, sizeof(block))) > 0) {
+        buffer.insert(buffer.end(), block, block + count);
+    }
+    close(fd);
+
+    if (count < 0) {
+        throw std::runtime_error("Unable to read file: " + path + "\n");
+    }
+    length = buffer.size();
+}
+
+
+MappedFile::~MappedFile() {
+    if (mapped) {
+        munmap(const_cast<char*>(mapped), length);
+    }
+}
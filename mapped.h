@@ -0,0 +1,30 @@
+#ifndef MAPPED_H
+#define MAPPED_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/// @brief Read-only contents of a whole file, memory mapped so reading it costs page faults
+/// instead of a copy. Files that cannot be mapped, eg. pipes, are read into memory instead.
+class MappedFile {
+public:
+    /// @param path file to open
+    /// @throws if the file cannot be opened or read
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return mapped ? mapped : buffer.data(); }
+    size_t size() const { return length; }
+
+private:
+    const char* mapped = nullptr;
+    size_t length = 0;
+    std::vector<char> buffer;       // Contents of a file that could not be mapped
+};
+
+#endif
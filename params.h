@@ -0,0 +1,88 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+/// @brief Lock-free single producer, single consumer channel for parameter snapshots.
+/// The producer fills back() and publishes it, the consumer picks up the newest published
+/// snapshot with update() and reads front(). Neither side ever waits for the other, and
+/// snapshots the consumer missed are skipped rather than queued.
+template <typename T>
+class TripleBuffer {
+public:
+    /// @param initial value of all three slots, so they never have to allocate later
+    explicit TripleBuffer(const T& initial) : slots{initial, initial, initial} {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /// @brief Producer's slot, not seen by the consumer until published
+    T& back() { return slots[backIndex]; }
+
+    /// @brief Makes back() the newest snapshot and hands the producer a free slot
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /// @brief Consumer side, swaps in the newest snapshot if one was published since the last call
+    /// @return true if front() changed
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    /// @brief Consumer's current snapshot
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4;       // Set in middle when it holds an unread snapshot
+
+    T slots[3];
+    uint8_t frontIndex = 0;                     // Consumer only
+    uint8_t backIndex = 1;                      // Producer only
+    std::atomic<uint8_t> middle{2};
+};
+
+
+/// @brief Linear per sample ramp of a parameter towards its latest target, so changes
+/// during playback do not step and cause zipper noise
+class ParamRamp {
+public:
+    explicit ParamRamp(float value = 0.0f) : value(value), target(value) {}
+
+    /// @brief Starts ramping from the current value
+    /// @param to new target
+    /// @param frames samples to reach it over, 0 to jump
+    void start(float to, size_t frames) {
+        target = to;
+        remaining = frames;
+        step = frames ? (to - value) / frames : 0.0f;
+        if (!frames) value = to;
+    }
+
+    /// @brief Value for the next sample
+    float next() {
+        if (remaining) {
+            value = --remaining ? value + step : target;
+        }
+        return value;
+    }
+
+    bool ramping() const { return remaining > 0; }
+    float current() const { return value; }
+
+private:
+    float value;
+    float target;
+    float step = 0.0f;
+    size_t remaining = 0;
+};
+
+#endif
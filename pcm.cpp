@@ -0,0 +1,374 @@
+#include "pcm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+
+// Unsigned 8-bit samples, silence at 128
+struct Unsigned8 {
+    static constexpr size_t BYTES = 1;
+
+    static float decode(const char* input) {
+        return (static_cast<unsigned char>(*input) - 128) * (1.0f / 128.0f);
+    }
+
+    static bool encode(float x, char* output) {
+        float scaled = x * 128.0f;
+        float sample = std::min(std::max(scaled, -128.0f), 127.0f);
+        *output = static_cast<char>(static_cast<int32_t>(sample + (sample < 0.0f ? -0.5f : 0.5f)) + 128);
+        return scaled < -128.0f || scaled > 127.0f;
+    }
+};
+
+
+// Signed little-endian samples of 2, 3 or 4 bytes. Sizes over 16 bits are scaled in double,
+// since float cannot hold every 32-bit value or round 24-bit ones at the top of the range
+template <size_t Bytes>
+struct SignedPcm {
+    static constexpr size_t BYTES = Bytes;
+
+    // Whole 16 and 32-bit samples are copied as integers, so the loops vectorise
+    using Int = std::conditional_t<BYTES == 2, int16_t, int32_t>;
+    using Real = std::conditional_t<(BYTES > 2), double, float>;
+    static constexpr Real SCALE = static_cast<Real>(int64_t(1) << (8 * BYTES - 1));
+    static constexpr Real MIN = -SCALE;
+    static constexpr Real MAX = SCALE - 1;
+
+    static float decode(const char* input) {
+        int32_t value;
+        if constexpr (BYTES == 3) {
+            // Loaded into the top bytes, so the shift back down extends the sign
+            uint32_t bits = 0;
+            std::memcpy(reinterpret_cast<char*>(&bits) + 1, input, 3);
+            value = static_cast<int32_t>(bits) >> 8;
+        } else {
+            Int sample;
+            std::memcpy(&sample, input, BYTES);
+            value = sample;
+        }
+        return static_cast<float>(value * (1 / SCALE));
+    }
+
+    static bool encode(float x, char* output) {
+        Real scaled = x * SCALE;
+        Real sample = std::min(std::max(scaled, MIN), MAX);
+        // Round half away from zero, the cast truncates
+        int32_t value = static_cast<int32_t>(sample + (sample < 0 ? Real(-0.5) : Real(0.5)));
+        if constexpr (BYTES == 3) {
+            std::memcpy(output, &value, 3);
+        } else {
+            Int narrowed = value;
+            std::memcpy(output, &narrowed, BYTES);
+        }
+        return scaled < MIN || scaled > MAX;
+    }
+};
+
+
+// IEEE 754 single precision samples, stored as they are
+struct Float32 {
+    static constexpr size_t BYTES = 4;
+
+    static float decode(const char* input) {
+        float x;
+        std::memcpy(&x, input, sizeof(x));
+        return x;
+    }
+
+    static bool encode(float x, char* output) {
+        std::memcpy(output, &x, sizeof(x));
+        return false;
+    }
+};
+
+
+// 16-bit kernels of one instruction set, each returns the number of frames done and leaves
+// the rest to the scalar loops
+struct Pcm16Kernels {
+    size_t (*decodeMono)(const char* input, float* output, size_t n);
+    size_t (*decodeStereo)(const char* input, size_t frames, float* left, float* right);
+    size_t (*encodeMono)(const float* input, char* output, size_t n, size_t& saturated);
+    size_t (*encodeStereo)(const float* left, const float* right, size_t frames, char* output, size_t& saturated);
+};
+
+// Leaves everything to the scalar loops
+static constexpr Pcm16Kernels SCALAR_KERNELS{
+    [](const char*, float*, size_t) -> size_t { return 0; },
+    [](const char*, size_t, float*, float*) -> size_t { return 0; },
+    [](const float*, char*, size_t, size_t&) -> size_t { return 0; },
+    [](const float*, const float*, size_t, char*, size_t&) -> size_t { return 0; },
+};
+
+static bool vectorKernels = true;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// 16-bit sample kernels, a vector of 8 frames at a time. The shuffles are written once with
+// vector extensions and built twice, for SSE2, the x86-64 baseline, and for AVX2, picked when
+// the CPU has it.
+typedef int16_t Int16x8 __attribute__((vector_size(16)));
+typedef int16_t Int16x16 __attribute__((vector_size(32)));
+typedef int32_t Int32x8 __attribute__((vector_size(32)));
+typedef float Float32x8 __attribute__((vector_size(32)));
+
+constexpr size_t PCM16_VECTOR = 8;
+
+// Whole float vectors only go through memory, as passing them by value needs AVX
+static inline __attribute__((always_inline))
+void pcm16ToFloat(Int16x8 x, float* output) {
+    Float32x8 y = __builtin_convertvector(x, Float32x8) * (1.0f / 32768.0f);
+    std::memcpy(output, &y, sizeof(y));
+}
+
+// Same steps as SignedPcm<2>::encode, so results match bit for bit: scale, saturate, round half
+// away from zero and truncate. Saturated samples are counted as -1 in each lane of saturated.
+static inline __attribute__((always_inline))
+Int16x8 floatToPcm16(const float* input, Int32x8& saturated) {
+    const Float32x8 min = Float32x8{} - 32768.0f;
+    const Float32x8 max = Float32x8{} + 32767.0f;
+    const Float32x8 half = Float32x8{} + 0.5f;
+
+    Float32x8 x;
+    std::memcpy(&x, input, sizeof(x));
+    Float32x8 scaled = x * 32768.0f;
+    saturated += (scaled < min) | (scaled > max);
+    Float32x8 sample = scaled < min ? min : scaled;
+    sample = max < sample ? max : sample;
+    sample += sample < 0.0f ? -half : half;
+    return __builtin_convertvector(__builtin_convertvector(sample, Int32x8), Int16x8);
+}
+
+static inline __attribute__((always_inline))
+size_t countSaturated(const Int32x8& saturated) {
+    size_t count = 0;
+    for (size_t i = 0; i < PCM16_VECTOR; i++) {
+        count -= saturated[i];
+    }
+    return count;
+}
+
+static inline __attribute__((always_inline))
+size_t decodeMono16(const char* input, float* output, size_t n) {
+    size_t i = 0;
+    for (; i + PCM16_VECTOR <= n; i += PCM16_VECTOR) {
+        Int16x8 x;
+        std::memcpy(&x, input + 2 * i, sizeof(x));
+        pcm16ToFloat(x, output + i);
+    }
+    return i;
+}
+
+static inline __attribute__((always_inline))
+size_t decodeStereo16(const char* input, size_t frames, float* left, float* right) {
+    size_t i = 0;
+    for (; i + PCM16_VECTOR <= frames; i += PCM16_VECTOR) {
+        Int16x16 x;
+        std::memcpy(&x, input + 4 * i, sizeof(x));
+        pcm16ToFloat(__builtin_shufflevector(x, x, 0, 2, 4, 6, 8, 10, 12, 14), left + i);
+        pcm16ToFloat(__builtin_shufflevector(x, x, 1, 3, 5, 7, 9, 11, 13, 15), right + i);
+    }
+    return i;
+}
+
+static inline __attribute__((always_inline))
+size_t encodeMono16(const float* input, char* output, size_t n, size_t& saturated) {
+    Int32x8 count{};
+    size_t i = 0;
+    for (; i + PCM16_VECTOR <= n; i += PCM16_VECTOR) {
+        Int16x8 y = floatToPcm16(input + i, count);
+        std::memcpy(output + 2 * i, &y, sizeof(y));
+    }
+    saturated += countSaturated(count);
+    return i;
+}
+
+static inline __attribute__((always_inline))
+size_t encodeStereo16(const float* left, const float* right, size_t frames, char* output, size_t& saturated) {
+    Int32x8 count{};
+    size_t i = 0;
+    for (; i + PCM16_VECTOR <= frames; i += PCM16_VECTOR) {
+        Int16x8 l = floatToPcm16(left + i, count);
+        Int16x8 r = floatToPcm16(right + i, count);
+        Int16x16 y = __builtin_shufflevector(l, r, 0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+        std::memcpy(output + 4 * i, &y, sizeof(y));
+    }
+    saturated += countSaturated(count);
+    return i;
+}
+
+static size_t sse2DecodeMono(const char* input, float* output, size_t n) {
+    return decodeMono16(input, output, n);
+}
+
+static size_t sse2DecodeStereo(const char* input, size_t frames, float* left, float* right) {
+    return decodeStereo16(input, frames, left, right);
+}
+
+static size_t sse2EncodeMono(const float* input, char* output, size_t n, size_t& saturated) {
+    return encodeMono16(input, output, n, saturated);
+}
+
+static size_t sse2EncodeStereo(const float* left, const float* right, size_t frames, char* output, size_t& saturated) {
+    return encodeStereo16(left, right, frames, output, saturated);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2DecodeMono(const char* input, float* output, size_t n) {
+    return decodeMono16(input, output, n);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2DecodeStereo(const char* input, size_t frames, float* left, float* right) {
+    return decodeStereo16(input, frames, left, right);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2EncodeMono(const float* input, char* output, size_t n, size_t& saturated) {
+    return encodeMono16(input, output, n, saturated);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2EncodeStereo(const float* left, const float* right, size_t frames, char* output, size_t& saturated) {
+    return encodeStereo16(left, right, frames, output, saturated);
+}
+
+static const Pcm16Kernels& pcm16Kernels() {
+    static const Pcm16Kernels kernels = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Pcm16Kernels{avx2DecodeMono, avx2DecodeStereo, avx2EncodeMono, avx2EncodeStereo};
+        }
+        return Pcm16Kernels{sse2DecodeMono, sse2DecodeStereo, sse2EncodeMono, sse2EncodeStereo};
+    }();
+    return vectorKernels ? kernels : SCALAR_KERNELS;
+}
+
+#else
+
+static const Pcm16Kernels& pcm16Kernels() {
+    return SCALAR_KERNELS;
+}
+
+#endif
+
+
+void setPcmVectorKernels(bool enabled) {
+    vectorKernels = enabled;
+}
+
+
+template <typename Format>
+static void decodeSamples(const char* input, float* output, size_t n) {
+    size_t i = 0;
+    if constexpr (std::is_same_v<Format, SignedPcm<2>>) {
+        i = pcm16Kernels().decodeMono(input, output, n);
+    }
+
+    for (; i < n; i++) {
+        output[i] = Format::decode(input + i * Format::BYTES);
+    }
+}
+
+
+template <typename Format>
+static void deinterleaveSamples(const char* input, size_t frames, size_t numChannels, float* const* channels) {
+    if (numChannels == 1) {
+        decodeSamples<Format>(input, channels[0], frames);
+        return;
+    }
+
+    if (numChannels == 2) {
+        float* left = channels[0];
+        float* right = channels[1];
+        size_t i = 0;
+        if constexpr (std::is_same_v<Format, SignedPcm<2>>) {
+            i = pcm16Kernels().decodeStereo(input, frames, left, right);
+        }
+
+        for (; i < frames; i++) {
+            left[i] = Format::decode(input + 2 * i * Format::BYTES);
+            right[i] = Format::decode(input + (2 * i + 1) * Format::BYTES);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t c = 0; c < numChannels; c++) {
+            channels[c][i] = Format::decode(input + (i * numChannels + c) * Format::BYTES);
+        }
+    }
+}
+
+
+template <typename Format>
+static size_t encodeSamples(const float* input, char* output, size_t n) {
+    size_t saturated = 0;
+    size_t i = 0;
+    if constexpr (std::is_same_v<Format, SignedPcm<2>>) {
+        i = pcm16Kernels().encodeMono(input, output, n, saturated);
+    }
+
+    for (; i < n; i++) {
+        saturated += Format::encode(input[i], output + i * Format::BYTES);
+    }
+    return saturated;
+}
+
+
+template <typename Format>
+static size_t interleaveSamples(const float* const* channels, size_t frames, size_t numChannels, char* output) {
+    if (numChannels == 1) {
+        return encodeSamples<Format>(channels[0], output, frames);
+    }
+
+    size_t saturated = 0;
+
+    if (numChannels == 2) {
+        const float* left = channels[0];
+        const float* right = channels[1];
+        size_t i = 0;
+        if constexpr (std::is_same_v<Format, SignedPcm<2>>) {
+            i = pcm16Kernels().encodeStereo(left, right, frames, output, saturated);
+        }
+
+        for (; i < frames; i++) {
+            saturated += Format::encode(left[i], output + 2 * i * Format::BYTES);
+            saturated += Format::encode(right[i], output + (2 * i + 1) * Format::BYTES);
+        }
+        return saturated;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t c = 0; c < numChannels; c++) {
+            saturated += Format::encode(channels[c][i], output + (i * numChannels + c) * Format::BYTES);
+        }
+    }
+    return saturated;
+}
+
+
+template <typename Format>
+static constexpr PcmCodec makeCodec(uint16_t audioFormat) {
+    return {audioFormat, 8 * Format::BYTES, Format::BYTES,
+            decodeSamples<Format>, deinterleaveSamples<Format>, encodeSamples<Format>, interleaveSamples<Format>};
+}
+
+
+static constexpr PcmCodec CODECS[] = {
+    makeCodec<Unsigned8>(WAVE_FORMAT_PCM),
+    makeCodec<SignedPcm<2>>(WAVE_FORMAT_PCM),
+    makeCodec<SignedPcm<3>>(WAVE_FORMAT_PCM),
+    makeCodec<SignedPcm<4>>(WAVE_FORMAT_PCM),
+    makeCodec<Float32>(WAVE_FORMAT_IEEE_FLOAT),
+};
+
+
+const PcmCodec* findPcmCodec(uint16_t audioFormat, uint16_t bitsPerSample) {
+    for (const PcmCodec& codec : CODECS) {
+        if (codec.audioFormat == audioFormat && codec.bitsPerSample == bitsPerSample) {
+            return &codec;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,56 @@
+#ifndef PCM_H
+#define PCM_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+// WAV format codes, WAVE_FORMAT_EXTENSIBLE files name one of the first two in their subformat
+static constexpr uint16_t WAVE_FORMAT_PCM = 1;
+static constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 3;
+static constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+
+/// @brief Conversions between the samples of one WAV format and float in [-1, 1). Each
+/// format has its own instantiation of the conversion loops, so the format is chosen once
+/// per call and never per sample. 16-bit mono and stereo run through SSE2/AVX2 kernels on
+/// x86, with the same results as the scalar loops. The file bytes may be unaligned.
+struct PcmCodec {
+    uint16_t audioFormat;
+    uint16_t bitsPerSample;
+    size_t bytes;               // Bytes per sample
+
+    /// @brief Converts interleaved file samples to interleaved floats
+    /// @param n number of samples
+    void (*decode)(const char* input, float* output, size_t n);
+
+    /// @brief Converts interleaved file samples to planar float channels
+    /// @param frames number of frames
+    /// @param channels one output per channel of the frames
+    void (*deinterleave)(const char* input, size_t frames, size_t numChannels, float* const* channels);
+
+    /// @brief Converts interleaved floats to file samples, saturating integer formats
+    /// @param n number of samples
+    /// @return number of samples saturated
+    size_t (*encode)(const float* input, char* output, size_t n);
+
+    /// @brief Converts planar float channels to interleaved file samples, saturating integer formats
+    /// @param channels one input per channel of the frames
+    /// @param frames number of frames
+    /// @return number of samples saturated
+    size_t (*interleave)(const float* const* channels, size_t frames, size_t numChannels, char* output);
+};
+
+
+/// @brief Codec of a WAV format
+/// @param audioFormat WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT
+/// @param bitsPerSample 8, 16, 24 or 32 for PCM, 32 for float
+/// @return nullptr if the format is not supported
+const PcmCodec* findPcmCodec(uint16_t audioFormat, uint16_t bitsPerSample);
+
+
+/// @brief Turns the SSE2/AVX2 16-bit kernels on or off, eg. off to run the scalar loops as the
+/// reference for verification. Not thread-safe, set it before converting.
+void setPcmVectorKernels(bool enabled);
+
+#endif
@@ -0,0 +1,198 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+// Set while this thread is running a task, so nested parallelFor calls run inline
+static thread_local bool insideTask = false;
+
+ThreadPool::ThreadPool(size_t numThreads) {
+    if (numThreads == 0) {
+        throw std::runtime_error("Thread pool needs at least 1 thread\n");
+    }
+
+    for (size_t i = 1; i < numThreads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& task) {
+    if (n == 0) return;
+
+    if (workers.empty() || n == 1 || insideTask) {
+        for (size_t i = 0; i < n; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> dispatchLock(dispatch);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        jobSize = n;
+        next = 0;
+        error = nullptr;
+        generation++;
+    }
+    wake.notify_all();
+
+    runTasks(task, n);
+
+    // Workers that joined the job must leave it before the task goes out of scope
+    std::exception_ptr failure;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return active == 0; });
+        job = nullptr;
+        failure = error;
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+
+// Task indices [begin, end) left for a worker of parallelForStealing, the owner takes
+// from the front and thieves from the back
+struct alignas(64) StealRange {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+
+static bool takeFront(StealRange& range, size_t& index) {
+    std::lock_guard<std::mutex> lock(range.mutex);
+    if (range.begin == range.end) return false;
+
+    index = range.begin++;
+    return true;
+}
+
+
+// Moves the back half of the largest range left into the thief's empty range
+static bool steal(std::vector<StealRange>& ranges, size_t thief, size_t& index) {
+    while (true) {
+        size_t victim = thief;
+        size_t most = 0;
+        for (size_t w = 0; w < ranges.size(); w++) {
+            std::lock_guard<std::mutex> lock(ranges[w].mutex);
+            if (ranges[w].end - ranges[w].begin > most) {
+                most = ranges[w].end - ranges[w].begin;
+                victim = w;
+            }
+        }
+        if (most == 0) return false;
+
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+            size_t left = ranges[victim].end - ranges[victim].begin;
+            if (left == 0) continue;
+
+            end = ranges[victim].end;
+            begin = end - (left + 1) / 2;
+            ranges[victim].end = begin;
+        }
+
+        std::lock_guard<std::mutex> lock(ranges[thief].mutex);
+        ranges[thief].begin = begin + 1;
+        ranges[thief].end = end;
+        index = begin;
+        return true;
+    }
+}
+
+
+void ThreadPool::parallelForStealing(size_t n, const std::function<void(size_t, size_t)>& task) {
+    if (n == 0) return;
+
+    const size_t numWorkers = std::min(size(), n);
+    std::vector<StealRange> ranges(numWorkers);
+    for (size_t w = 0; w < numWorkers; w++) {
+        ranges[w].begin = n * w / numWorkers;
+        ranges[w].end = n * (w + 1) / numWorkers;
+    }
+
+    parallelFor(numWorkers, [&](size_t worker) {
+        size_t index;
+        while (takeFront(ranges[worker], index) || steal(ranges, worker, index)) {
+            task(worker, index);
+        }
+    });
+}
+
+
+void ThreadPool::runTasks(const std::function<void(size_t)>& task, size_t n) {
+    insideTask = true;
+
+    for (size_t i = next++; i < n; i = next++) {
+        try {
+            task(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+        }
+    }
+
+    insideTask = false;
+}
+
+
+void ThreadPool::workerLoop() {
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        wake.wait(lock, [&] { return stopping || (job && generation != seen); });
+        if (stopping) return;
+
+        seen = generation;
+        active++;
+        const std::function<void(size_t)>* task = job;
+        size_t n = jobSize;
+
+        lock.unlock();
+        runTasks(*task, n);
+        lock.lock();
+
+        if (--active == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+
+static std::unique_ptr<ThreadPool>& globalPool() {
+    static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>(1);
+    return pool;
+}
+
+
+ThreadPool& ThreadPool::global() {
+    return *globalPool();
+}
+
+
+void ThreadPool::setGlobalThreads(size_t numThreads) {
+    if (numThreads == global().size()) return;
+    globalPool() = std::make_unique<ThreadPool>(numThreads);
+}
@@ -0,0 +1,72 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// @brief Fixed set of worker threads that DSP functions dispatch independent tasks onto.
+/// The calling thread always works on its own job too, so a pool of size 1 has no workers
+/// and runs everything inline.
+class ThreadPool {
+public:
+    /// @param numThreads threads working on a job, including the calling thread
+    explicit ThreadPool(size_t numThreads = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// @brief Runs task(i) for every i in [0, n) and returns once all of them have finished.
+    /// Called from inside a task it runs inline, so nested dispatch cannot deadlock.
+    /// @param n number of tasks
+    /// @param task function called with each task index
+    /// @throws the first exception thrown by any task
+    void parallelFor(size_t n, const std::function<void(size_t)>& task);
+
+    /// @brief Runs task(worker, i) for every i in [0, n) with work stealing, for tasks whose
+    /// cost varies a lot, eg. whole files. Each worker starts with an even share of the indices
+    /// and works through it in order, then steals the back half of the largest share left.
+    /// A worker runs on one thread at a time, so it can own per worker state.
+    /// @param n number of tasks
+    /// @param task function called with the worker in [0, size()) and each task index
+    /// @throws the first exception thrown by any task
+    void parallelForStealing(size_t n, const std::function<void(size_t, size_t)>& task);
+
+    size_t size() const { return workers.size() + 1; }
+
+    /// @brief Process-wide pool, 1 thread unless changed with setGlobalThreads
+    static ThreadPool& global();
+
+    /// @brief Replaces the process-wide pool, eg. from the -j command line option
+    /// @param numThreads threads working on a job, >= 1
+    static void setGlobalThreads(size_t numThreads);
+
+private:
+    void workerLoop();
+    void runTasks(const std::function<void(size_t)>& task, size_t n);
+
+    std::vector<std::thread> workers;
+
+    std::mutex dispatch;                // One job at a time
+    std::mutex mutex;                   // Guards the job and worker state below
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobSize = 0;
+    std::atomic<size_t> next{0};        // Next task index to hand out
+    size_t generation = 0;              // Incremented for every job
+    size_t active = 0;                  // Workers currently running tasks of the job
+    bool stopping = false;
+
+    std::exception_ptr error;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+
+#include "audio.h"
+
+// Bytes requested through the counting operator new, when it is linked in
+static std::atomic<size_t> allocated{0};
+
+
+void countAllocation(size_t size) {
+    allocated.fetch_add(size, std::memory_order_relaxed);
+}
+
+
+size_t Profiler::allocatedBytes() {
+    return allocated.load(std::memory_order_relaxed);
+}
+
+
+void Profiler::begin(size_t samples) {
+    startSamples = samples;
+    startBytes = allocatedBytes();
+    startClipped = AudioProcessor::getClippedSamples();
+    start = std::chrono::steady_clock::now();
+}
+
+
+Profiler::Counters Profiler::end(const std::string& command, size_t samples) {
+    Counters run;
+    run.calls = 1;
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.samples = std::max(startSamples, samples);
+    run.bytesAllocated = allocatedBytes() - startBytes;
+    run.clipped = AudioProcessor::getClippedSamples() - startClipped;
+
+    auto found = std::find_if(totals.begin(), totals.end(), [&](const auto& entry) { return entry.first == command; });
+    if (found == totals.end()) {
+        totals.emplace_back(command, Counters());
+        found = totals.end() - 1;
+    }
+
+    Counters& total = found->second;
+    total.calls += run.calls;
+    total.seconds += run.seconds;
+    total.samples += run.samples;
+    total.bytesAllocated += run.bytesAllocated;
+    total.clipped += run.clipped;
+
+    return run;
+}
+
+
+void Profiler::print(std::ostream& console) const {
+    if (totals.empty()) {
+        console << "No commands run yet\n\n";
+        return;
+    }
+
+    // Formatted apart so the precision of the console is left alone
+    std::ostringstream out;
+
+    out << std::left << std::setw(8) << "Command" << std::right << std::setw(8) << "Calls" << std::setw(14) << "Time (ms)"
+        << std::setw(14) << "Samples" << std::setw(12) << "ns/sample" << std::setw(16) << "Allocated (B)"
+        << std::setw(12) << "Clipped" << '\n';
+
+    for (const auto& [command, total] : totals) {
+        out << std::left << std::setw(8) << command << std::right << std::setw(8) << total.calls
+            << std::fixed << std::setprecision(3) << std::setw(14) << total.seconds * 1e3
+            << std::setw(14) << total.samples << std::setprecision(2) << std::setw(12)
+            << (total.samples ? total.seconds * 1e9 / total.samples : 0.0)
+            << std::setw(16) << total.bytesAllocated << std::setw(12) << total.clipped << '\n';
+    }
+    out << '\n';
+    console << out.str();
+}
+
+
+void Profiler::printRun(std::ostream& console, const std::string& command, const Counters& run) {
+    std::ostringstream out;
+    out << command << ": " << std::fixed << std::setprecision(3) << run.seconds * 1e3 << " ms, "
+        << run.samples << " samples, " << std::setprecision(2)
+        << (run.samples ? run.seconds * 1e9 / run.samples : 0.0) << " ns/sample, "
+        << run.bytesAllocated << " bytes allocated, " << run.clipped << " clipped\n\n";
+    console << out.str();
+}
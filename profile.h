@@ -0,0 +1,57 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/// @brief Times REPL commands and counts what they do, per run and accumulated per command
+/// over the session. Only one command is measured at a time.
+class Profiler {
+public:
+    struct Counters {
+        size_t calls = 0;
+        double seconds = 0.0;           // Wall time
+        size_t samples = 0;             // Samples of the audio the command ran on, over all channels
+        size_t bytesAllocated = 0;      // Bytes requested from operator new, not counting frees
+        size_t clipped = 0;             // Samples saturated converting to 16-bit PCM
+    };
+
+    /// @brief Starts measuring a command
+    /// @param samples samples of the audio before the command
+    void begin(size_t samples);
+
+    /// @brief Stops measuring and adds the run to the totals of the command
+    /// @param command code of the command
+    /// @param samples samples of the audio after the command, the larger of the two is used
+    /// @return counters of this run
+    Counters end(const std::string& command, size_t samples);
+
+    /// @brief Prints the totals of every command run so far, in order of first use
+    void print(std::ostream& out) const;
+
+    /// @brief Prints the counters of one run on a line
+    static void printRun(std::ostream& out, const std::string& command, const Counters& run);
+
+    /// @brief Bytes requested from the global operator new since the program started,
+    /// counted over every thread, always 0 without the replacements in alloc.cpp
+    static size_t allocatedBytes();
+
+private:
+    std::chrono::steady_clock::time_point start;
+    size_t startSamples = 0;
+    size_t startBytes = 0;
+    size_t startClipped = 0;
+
+    std::vector<std::pair<std::string, Counters>> totals;
+};
+
+/// @brief Adds to the bytes reported by Profiler::allocatedBytes, called by the replacements
+/// of operator new in alloc.cpp
+void countAllocation(size_t size);
+
+#endif
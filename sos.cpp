@@ -0,0 +1,462 @@
+#include "sos.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+
+using Complex = std::complex<double>;
+
+
+/********************************* Filter Design ***********************************/
+
+// Roots of c[0]*z^n + c[1]*z^(n-1) + ... + c[n], c[0] != 0, by Aberth-Ehrlich iteration
+static std::vector<Complex> polyRoots(const std::vector<double>& c) {
+    size_t n = c.size() - 1;
+    if (n == 0) return {};
+    if (n == 1) return {Complex(-c[1] / c[0], 0.0)};
+
+    std::vector<double> monic(c.size());
+    for (size_t i = 0; i <= n; i++) monic[i] = c[i] / c[0];
+
+    // Start on a circle enclosing every root, rotated off the real axis
+    double radius = 0.0;
+    for (size_t i = 1; i <= n; i++) radius = std::max(radius, std::abs(monic[i]));
+    radius = std::min(1.0 + radius, 2.0);
+
+    std::vector<Complex> z(n);
+    for (size_t k = 0; k < n; k++) {
+        z[k] = std::polar(radius, 2.0 * M_PI * k / n + 0.4);
+    }
+
+    for (int iter = 0; iter < 500; iter++) {
+        double maxStep = 0.0;
+
+        for (size_t k = 0; k < n; k++) {
+            // Horner for p(z) and p'(z)
+            Complex p = monic[0], dp = 0.0;
+            for (size_t i = 1; i <= n; i++) {
+                dp = dp * z[k] + p;
+                p = p * z[k] + monic[i];
+            }
+            if (p == 0.0) continue;
+
+            Complex ratio = p / dp;
+            Complex repulsion = 0.0;
+            for (size_t j = 0; j < n; j++) {
+                if (j != k) repulsion += 1.0 / (z[k] - z[j]);
+            }
+
+            Complex step = ratio / (1.0 - ratio * repulsion);
+            z[k] -= step;
+            maxStep = std::max(maxStep, std::abs(step) / std::max(1.0, std::abs(z[k])));
+        }
+
+        if (maxStep < 1e-15) break;
+    }
+
+    return z;
+}
+
+// Groups roots into real quadratics {1, c1, c2} of z^(-1), ie. (1 - r1*z^-1)(1 - r2*z^-1).
+// Conjugate pairs stay together, real roots are paired in order and a leftover real is first order.
+static std::vector<std::vector<double>> pairRoots(std::vector<Complex> roots) {
+    std::vector<std::vector<double>> quads;
+    std::vector<double> reals;
+
+    for (Complex& r : roots) {
+        if (std::abs(r.imag()) < 1e-10 * std::max(1.0, std::abs(r))) r = r.real();
+    }
+
+    std::vector<bool> used(roots.size(), false);
+    for (size_t i = 0; i < roots.size(); i++) {
+        if (used[i]) continue;
+        if (roots[i].imag() == 0.0) {
+            reals.push_back(roots[i].real());
+            used[i] = true;
+            continue;
+        }
+
+        // Closest unused root to the conjugate
+        size_t partner = i;
+        double best = INFINITY;
+        for (size_t j = i + 1; j < roots.size(); j++) {
+            double d = std::abs(roots[j] - std::conj(roots[i]));
+            if (!used[j] && roots[j].imag() != 0.0 && d < best) {
+                best = d;
+                partner = j;
+            }
+        }
+        if (partner == i) {
+            throw std::runtime_error("Filter coefficients have an unpaired complex root\n");
+        }
+
+        used[i] = used[partner] = true;
+        quads.push_back({1.0, -(roots[i] + roots[partner]).real(), (roots[i] * roots[partner]).real()});
+    }
+
+    std::sort(reals.begin(), reals.end());
+    for (size_t i = 0; i < reals.size(); i += 2) {
+        if (i + 1 < reals.size()) {
+            quads.push_back({1.0, -(reals[i] + reals[i + 1]), reals[i] * reals[i + 1]});
+        } else {
+            quads.push_back({1.0, -reals[i], 0.0});
+        }
+    }
+
+    return quads;
+}
+
+// Largest root magnitude of a quadratic {1, c1, c2}, used to order sections
+static double quadRadius(const std::vector<double>& q) {
+    Complex disc = std::sqrt(Complex(q[1] * q[1] - 4.0 * q[2], 0.0));
+    return std::max(std::abs((-q[1] + disc) / 2.0), std::abs((-q[1] - disc) / 2.0));
+}
+
+// Builds sections from numerator and denominator quadratics already in cascade order,
+// the overall gain applied to the first section
+static std::vector<Biquad> assembleSections(const std::vector<std::vector<double>>& zeros,
+                                            const std::vector<std::vector<double>>& poles, double gain) {
+    size_t numSections = std::max<size_t>(std::max(zeros.size(), poles.size()), 1);
+    std::vector<Biquad> sos(numSections, {1.0, 0.0, 0.0, 0.0, 0.0});
+
+    for (size_t i = 0; i < zeros.size(); i++) {
+        sos[i].b0 = zeros[i][0];
+        sos[i].b1 = zeros[i][1];
+        sos[i].b2 = zeros[i][2];
+    }
+    for (size_t i = 0; i < poles.size(); i++) {
+        sos[i].a1 = poles[i][1];
+        sos[i].a2 = poles[i][2];
+    }
+
+    sos[0].b0 *= gain;
+    sos[0].b1 *= gain;
+    sos[0].b2 *= gain;
+
+    return sos;
+}
+
+
+std::vector<Biquad> tf2sos(const std::vector<double>& b, const std::vector<double>& a) {
+    if (b.empty() || a.empty() || a[0] == 0.0) {
+        throw std::runtime_error("Invalid filter coefficients\n");
+    }
+
+    std::vector<double> num(b), den(a);
+    for (double& x : num) x /= a[0];
+    for (double& x : den) x /= a[0];
+
+    // Trailing zeros are roots at z = 0 and do not change the response
+    while (num.size() > 1 && num.back() == 0.0) num.pop_back();
+    while (den.size() > 1 && den.back() == 0.0) den.pop_back();
+
+    // Leading zeros of the numerator are pure delays
+    size_t delay = 0;
+    while (delay < num.size() && num[delay] == 0.0) delay++;
+    if (delay == num.size()) {
+        return {{0.0, 0.0, 0.0, 0.0, 0.0}};
+    }
+
+    double gain = num[delay];
+    std::vector<std::vector<double>> zeros = pairRoots(polyRoots(std::vector<double>(num.begin() + delay, num.end())));
+    std::vector<std::vector<double>> poles = pairRoots(polyRoots(den));
+
+    // Sections with poles furthest from the unit circle first, each paired with the closest zeros
+    std::sort(poles.begin(), poles.end(), [](const auto& x, const auto& y) { return quadRadius(x) < quadRadius(y); });
+    std::sort(zeros.begin(), zeros.end(), [](const auto& x, const auto& y) { return quadRadius(x) < quadRadius(y); });
+
+    // Delays become z^(-1) factors, merged into first order numerators where possible
+    for (auto& q : zeros) {
+        if (delay > 0 && q[2] == 0.0) {
+            q = {0.0, q[0], q[1]};
+            delay--;
+        }
+    }
+    while (delay > 0) {
+        zeros.push_back(delay >= 2 ? std::vector<double>{0.0, 0.0, 1.0} : std::vector<double>{0.0, 1.0, 0.0});
+        delay -= std::min<size_t>(delay, 2);
+    }
+
+    return assembleSections(zeros, poles, gain);
+}
+
+
+std::vector<Biquad> zpk2sos(const std::vector<std::complex<double>>& zeros, const std::vector<std::complex<double>>& poles, double gain) {
+    std::vector<std::vector<double>> zeroQuads = pairRoots(zeros);
+    std::vector<std::vector<double>> poleQuads = pairRoots(poles);
+
+    std::sort(poleQuads.begin(), poleQuads.end(), [](const auto& x, const auto& y) { return quadRadius(x) < quadRadius(y); });
+    std::sort(zeroQuads.begin(), zeroQuads.end(), [](const auto& x, const auto& y) { return quadRadius(x) < quadRadius(y); });
+
+    return assembleSections(zeroQuads, poleQuads, gain);
+}
+
+
+std::vector<double> sosStepState(const std::vector<Biquad>& sections) {
+    std::vector<double> state;
+    double scale = 1.0;   // Steady state input of the current section
+
+    for (const Biquad& q : sections) {
+        double denominator = 1.0 + q.a1 + q.a2;
+        if (denominator == 0.0) {
+            // Pole at DC, no steady state
+            state.insert(state.end(), {0.0, 0.0});
+            scale = 0.0;
+            continue;
+        }
+
+        // Solve y = b0*x + z1, z1 = b1*x + z2 - a1*y, z2 = b2*x - a2*y with x constant
+        double y = scale * (q.b0 + q.b1 + q.b2) / denominator;
+        state.push_back(y - q.b0 * scale);
+        state.push_back(q.b2 * scale - q.a2 * y);
+        scale = y;
+    }
+
+    return state;
+}
+
+double sosPoleRadius(const std::vector<Biquad>& sections) {
+    double radius = 0.0;
+    for (const Biquad& q : sections) {
+        radius = std::max(radius, quadRadius({1.0, q.a1, q.a2}));
+    }
+    return radius;
+}
+
+
+/************************************ Kernels **************************************/
+
+// Transposed direct form II, one section of one lane:
+//   y  = b0*x + z1
+//   z1 = (b1*x + z2) - a1*y
+//   z2 = b2*x - a2*y
+// Every kernel evaluates exactly these operations in this order without contraction,
+// so the vector kernels match the scalar reference bit for bit.
+
+static void scalarKernel(const double* input, double* output, size_t n, size_t stride, size_t lanes, size_t sections,
+                         const double* coeffs, double* state) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t l = 0; l < lanes; l++) {
+            double x = input[i * stride + l];
+
+            for (size_t s = 0; s < sections; s++) {
+                const double* c = coeffs + s * 5 * stride + l;
+                double* z = state + s * 2 * stride + l;
+
+                double y = c[0] * x + z[0];
+                z[0] = (c[stride] * x + z[stride]) - c[3 * stride] * y;
+                z[stride] = c[2 * stride] * x - c[4 * stride] * y;
+                x = y;
+            }
+
+            output[i * stride + l] = x;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+typedef double Vec2 __attribute__((vector_size(16)));
+typedef double Vec4 __attribute__((vector_size(32)));
+
+// G vectors of lanes through S sections, state and coefficients held in registers across frames.
+// Inlined into each ISA specific wrapper so the generic vector code compiles to SSE2 or AVX2.
+template <typename V, size_t G, size_t S>
+static inline __attribute__((always_inline))
+void vectorKernel(const double* input, double* output, size_t n, size_t stride, const double* coeffs, double* state) {
+    constexpr size_t W = sizeof(V) / sizeof(double);
+
+    V b0[S][G], b1[S][G], b2[S][G], a1[S][G], a2[S][G], z1[S][G], z2[S][G];
+    for (size_t s = 0; s < S; s++) {
+        for (size_t g = 0; g < G; g++) {
+            const double* c = coeffs + s * 5 * stride + g * W;
+            const double* z = state + s * 2 * stride + g * W;
+            std::memcpy(&b0[s][g], c, sizeof(V));
+            std::memcpy(&b1[s][g], c + stride, sizeof(V));
+            std::memcpy(&b2[s][g], c + 2 * stride, sizeof(V));
+            std::memcpy(&a1[s][g], c + 3 * stride, sizeof(V));
+            std::memcpy(&a2[s][g], c + 4 * stride, sizeof(V));
+            std::memcpy(&z1[s][g], z, sizeof(V));
+            std::memcpy(&z2[s][g], z + stride, sizeof(V));
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        V x[G];
+#pragma GCC unroll 4
+        for (size_t g = 0; g < G; g++) {
+            std::memcpy(&x[g], input + i * stride + g * W, sizeof(V));
+        }
+
+#pragma GCC unroll 2
+        for (size_t s = 0; s < S; s++) {
+#pragma GCC unroll 4
+            for (size_t g = 0; g < G; g++) {
+                V y = b0[s][g] * x[g] + z1[s][g];
+                z1[s][g] = (b1[s][g] * x[g] + z2[s][g]) - a1[s][g] * y;
+                z2[s][g] = b2[s][g] * x[g] - a2[s][g] * y;
+                x[g] = y;
+            }
+        }
+
+#pragma GCC unroll 4
+        for (size_t g = 0; g < G; g++) {
+            std::memcpy(output + i * stride + g * W, &x[g], sizeof(V));
+        }
+    }
+
+    for (size_t s = 0; s < S; s++) {
+        for (size_t g = 0; g < G; g++) {
+            double* z = state + s * 2 * stride + g * W;
+            std::memcpy(z, &z1[s][g], sizeof(V));
+            std::memcpy(z + stride, &z2[s][g], sizeof(V));
+        }
+    }
+}
+
+// Up to 4 vectors of lanes through 1 or 2 sections
+template <typename V>
+static inline __attribute__((always_inline))
+void vectorPass(size_t vectors, size_t sections, const double* input, double* output, size_t n, size_t stride,
+                const double* coeffs, double* state) {
+    switch (vectors * 2 + sections) {
+        case 3: vectorKernel<V, 1, 1>(input, output, n, stride, coeffs, state); break;
+        case 4: vectorKernel<V, 1, 2>(input, output, n, stride, coeffs, state); break;
+        case 5: vectorKernel<V, 2, 1>(input, output, n, stride, coeffs, state); break;
+        case 6: vectorKernel<V, 2, 2>(input, output, n, stride, coeffs, state); break;
+        case 7: vectorKernel<V, 3, 1>(input, output, n, stride, coeffs, state); break;
+        case 8: vectorKernel<V, 3, 2>(input, output, n, stride, coeffs, state); break;
+        case 9: vectorKernel<V, 4, 1>(input, output, n, stride, coeffs, state); break;
+        case 10: vectorKernel<V, 4, 2>(input, output, n, stride, coeffs, state); break;
+    }
+}
+
+static void sse2Pass(size_t vectors, size_t sections, const double* input, double* output, size_t n, size_t stride,
+                     const double* coeffs, double* state) {
+    vectorPass<Vec2>(vectors, sections, input, output, n, stride, coeffs, state);
+}
+
+__attribute__((target("avx2")))
+static void avx2Pass(size_t vectors, size_t sections, const double* input, double* output, size_t n, size_t stride,
+                     const double* coeffs, double* state) {
+    vectorPass<Vec4>(vectors, sections, input, output, n, stride, coeffs, state);
+}
+
+static SosFilter::Kernel detectKernel() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? SosFilter::Kernel::AVX2 : SosFilter::Kernel::SSE2;
+}
+
+#else
+
+static SosFilter::Kernel detectKernel() {
+    return SosFilter::Kernel::Scalar;
+}
+
+#endif
+
+static SosFilter::Kernel& currentKernel() {
+    static SosFilter::Kernel kernel = detectKernel();
+    return kernel;
+}
+
+
+/*********************************** SosFilter *************************************/
+
+SosFilter::SosFilter(const std::vector<std::vector<Biquad>>& laneSections) {
+    lanes = laneSections.size();
+    paddedLanes = strideFor(lanes);
+
+    sections = 0;
+    for (const auto& cascade : laneSections) {
+        sections = std::max(sections, cascade.size());
+    }
+
+    // Pass-through sections and lanes, y = x
+    coeffs.assign(sections * 5 * paddedLanes, 0.0);
+    for (size_t s = 0; s < sections; s++) {
+        std::fill_n(coeffs.begin() + s * 5 * paddedLanes, paddedLanes, 1.0);
+    }
+
+    for (size_t l = 0; l < lanes; l++) {
+        for (size_t s = 0; s < laneSections[l].size(); s++) {
+            const Biquad& q = laneSections[l][s];
+            double* c = coeffs.data() + s * 5 * paddedLanes + l;
+            c[0] = q.b0;
+            c[paddedLanes] = q.b1;
+            c[2 * paddedLanes] = q.b2;
+            c[3 * paddedLanes] = q.a1;
+            c[4 * paddedLanes] = q.a2;
+        }
+    }
+
+    reset();
+}
+
+void SosFilter::reset() {
+    state.assign(sections * 2 * paddedLanes, 0.0);
+}
+
+void SosFilter::setState(size_t lane, const std::vector<double>& sectionState, double scale) {
+    for (size_t s = 0; s < sections && 2 * s + 1 < sectionState.size(); s++) {
+        state[s * 2 * paddedLanes + lane] = sectionState[2 * s] * scale;
+        state[(s * 2 + 1) * paddedLanes + lane] = sectionState[2 * s + 1] * scale;
+    }
+}
+
+void SosFilter::process(const double* input, double* output, size_t n) {
+    if (sections == 0) {
+        if (input != output) std::copy(input, input + n * paddedLanes, output);
+        return;
+    }
+
+    Kernel kernel = currentKernel();
+
+    if (kernel == Kernel::Scalar) {
+        scalarKernel(input, output, n, paddedLanes, lanes, sections, coeffs.data(), state.data());
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    const size_t width = kernel == Kernel::AVX2 ? 4 : 2;
+
+    // Chunks of up to 4 vectors of lanes, sections 2 at a time in place after the first pass
+    for (size_t lane = 0; lane < paddedLanes; lane += 4 * width) {
+        size_t vectors = std::min<size_t>(4, (paddedLanes - lane) / width);
+
+        for (size_t s = 0; s < sections; s += 2) {
+            size_t count = std::min<size_t>(2, sections - s);
+            const double* src = (s == 0 ? input : output) + lane;
+            const double* c = coeffs.data() + s * 5 * paddedLanes + lane;
+            double* z = state.data() + s * 2 * paddedLanes + lane;
+
+            if (kernel == Kernel::AVX2) {
+                avx2Pass(vectors, count, src, output + lane, n, paddedLanes, c, z);
+            } else {
+                sse2Pass(vectors, count, src, output + lane, n, paddedLanes, c, z);
+            }
+        }
+    }
+#endif
+}
+
+SosFilter::Kernel SosFilter::getKernel() {
+    return currentKernel();
+}
+
+void SosFilter::setKernel(Kernel kernel) {
+    // Never wider than the CPU supports
+    Kernel best = detectKernel();
+    currentKernel() = static_cast<int>(kernel) <= static_cast<int>(best) ? kernel : best;
+}
+
+const char* SosFilter::kernelName(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Scalar: return "scalar";
+        case Kernel::SSE2: return "SSE2";
+        case Kernel::AVX2: return "AVX2";
+    }
+    return "";
+}
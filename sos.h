@@ -0,0 +1,99 @@
+#ifndef SOS_H
+#define SOS_H
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+
+// Second-order section, a0 normalised to 1
+//
+//      b0 + b1*z^(-1) + b2*z^(-2)
+// H = ----------------------------
+//      1 + a1*z^(-1) + a2*z^(-2)
+struct Biquad {
+    double b0, b1, b2;
+    double a1, a2;
+};
+
+
+/// @brief Factors a transfer function into cascaded second-order sections
+/// @param b Numerator Coefficents {b0, b1, b2, ...}
+/// @param a Denominator Coefficents {a0, a1, a2, ...}, a0 != 0
+/// @return sections whose cascade has the same response as b / a
+std::vector<Biquad> tf2sos(const std::vector<double>& b, const std::vector<double>& a);
+
+/// @brief Builds cascaded second-order sections from the zeros, poles and gain of a filter
+/// @param zeros zeros in the z-plane, complex ones in conjugate pairs
+/// @param poles poles in the z-plane, complex ones in conjugate pairs
+/// @param gain overall gain, applied to the first section
+/// @return sections whose cascade has the response gain * prod(1 - zeros z^-1) / prod(1 - poles z^-1)
+std::vector<Biquad> zpk2sos(const std::vector<std::complex<double>>& zeros, const std::vector<std::complex<double>>& poles, double gain);
+
+
+/// @brief Steady state of a cascade for a unit step input, like scipy's sosfilt_zi.
+/// Scaled by the first sample it starts the filter without the transient from a zero state.
+/// @param sections cascade of sections
+/// @return {z1, z2} of each section
+std::vector<double> sosStepState(const std::vector<Biquad>& sections);
+
+/// @brief Largest pole magnitude of a cascade, how slowly its impulse response decays
+/// @param sections cascade of sections
+double sosPoleRadius(const std::vector<Biquad>& sections);
+
+
+/// @brief Bank of biquad cascades run side by side, one lane per cascade.
+/// Lanes are packed into SIMD vectors so several channels or bands filter at the cost of one.
+class SosFilter {
+public:
+
+    enum class Kernel { Scalar, SSE2, AVX2 };
+
+    // Lanes are padded to a multiple of this so any vector width divides the frame stride
+    static constexpr size_t LANE_ALIGN = 4;
+
+    SosFilter() = default;
+
+    /// @param lanes sections of each lane, shorter cascades are padded with pass-through sections
+    explicit SosFilter(const std::vector<std::vector<Biquad>>& lanes);
+
+    /// @brief Clears the filter state of every lane
+    void reset();
+
+    /// @brief Sets the state of one lane
+    /// @param lane lane to set
+    /// @param sectionState {z1, z2} of each section, eg. from sosStepState
+    /// @param scale factor applied to every value, eg. the first input sample
+    void setState(size_t lane, const std::vector<double>& sectionState, double scale);
+
+    /// @brief Filters n frames, continuing from the current state
+    /// @param input frames of stride() values, lane l of frame i at input[i * stride() + l]
+    /// @param output same layout as input, may alias input
+    /// @param n number of frames
+    void process(const double* input, double* output, size_t n);
+
+    size_t numLanes() const { return lanes; }
+    size_t stride() const { return paddedLanes; }
+
+    /// @brief Frame stride of a filter with this many lanes, eg. to size buffers before building it
+    static size_t strideFor(size_t lanes) { return (lanes + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN; }
+    size_t numSections() const { return sections; }
+
+    /// @brief Kernel used by process(), the widest the CPU supports unless overridden
+    static Kernel getKernel();
+
+    /// @brief Overrides the kernel, eg. Kernel::Scalar as the reference for verification
+    static void setKernel(Kernel kernel);
+
+    static const char* kernelName(Kernel kernel);
+
+private:
+    size_t lanes = 0;
+    size_t paddedLanes = 0;
+    size_t sections = 0;
+
+    std::vector<double> coeffs;     // [section][b0, b1, b2, a1, a2][lane]
+    std::vector<double> state;      // [section][z1, z2][lane]
+};
+
+#endif
@@ -0,0 +1,886 @@
+#include "stream.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <thread>
+
+
+// Temporary file of one run of process, removed however the run ends
+struct TemporaryFile {
+    explicit TemporaryFile(std::filesystem::path path) : path(std::move(path)) {}
+    ~TemporaryFile() {
+        stream.close();
+        std::error_code ignored;
+        std::filesystem::remove(path, ignored);
+    }
+
+    bool open() {
+        stream.open(path, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+        return stream.is_open();
+    }
+
+    std::filesystem::path path;
+    std::fstream stream;
+};
+
+
+StreamProcessor::StreamProcessor(size_t blockSize) : blockSize(blockSize) {
+    if (blockSize == 0) {
+        throw std::runtime_error("Stream block size must be greater than 0\n");
+    }
+}
+
+
+bool StreamProcessor::addCommand(const std::vector<std::string>& argv) {
+    Op op;
+    if (!parseCommand(argv, op)) {
+        return false;
+    }
+
+    chain.push_back(op);
+    return true;
+}
+
+
+bool StreamProcessor::parseCommand(const std::vector<std::string>& argv, Op& op) {
+    if (argv.empty()) {
+        std::cerr << "Error: Empty command in chain\n\n";
+        return false;
+    }
+
+    const std::string& cmd = argv[0];
+    size_t argc = argv.size();
+
+    try {
+        if (cmd == "g") {
+            if (argc < 2 || argc > 5) {
+                std::cerr << "Usage: g g0 [sel] [start] [end]" << "\n\n";
+                return false;
+            }
+            op.type = Op::Type::Gain;
+            op.gain = stof(argv[1]);
+            if (argc >= 3 && !parseChannelMask(argv[2], op.channels)) return false;
+            if (argc >= 4) op.startDuration = stof(argv[3]);
+            if (argc == 5) op.endDuration = stof(argv[4]);
+        } else if (cmd == "eq") {
+            if (argc < 6 || argc > 8) {
+                std::cerr << "Usage: eq g0 g1 g2 g3 g4 [sel] [engine]" << "\n\n";
+                return false;
+            }
+            op.type = Op::Type::Equaliser;
+            for (int i = 1; i < 6; i++) {
+                op.gains.push_back(stof(argv[i]));
+            }
+            for (size_t i = 6; i < argc; i++) {
+                if (argv[i] == "fft") {
+                    // Streamed equalisers run the band filters through the spill file
+                    std::cerr << "Error: The FFT equaliser cannot be streamed, use iir\n\n";
+                    return false;
+                } else if (argv[i] != "iir" && !parseChannelMask(argv[i], op.channels)) {
+                    return false;
+                }
+            }
+        } else if (cmd == "ir") {
+            if (argc != 2 && argc != 3) {
+                std::cerr << "Usage: ir ir.wav [sel]" << "\n\n";
+                return false;
+            }
+            op.type = Op::Type::Convolution;
+            op.irFile = argv[1];
+            if (argc == 3 && !parseChannelMask(argv[2], op.channels)) return false;
+        } else if (cmd == "drc") {
+            if (argc > 6) {
+                std::cerr << "Usage: drc [thres] [ratio] [gain] [start] [end]" << "\n\n";
+                return false;
+            }
+            op.type = Op::Type::Compression;
+            if (argc >= 2) op.threshold = stof(argv[1]);
+            if (argc >= 3) op.ratio = stoi(argv[2]);
+            if (argc >= 4) op.makeUpGain = stof(argv[3]);
+            if (argc >= 5) op.startDuration = stof(argv[4]);
+            if (argc == 6) op.endDuration = stof(argv[5]);
+        } else {
+            std::cerr << "Error: Command '" << cmd << "' cannot be streamed (only g, eq, ir, drc)\n\n";
+            return false;
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: Invalid value in command '" << cmd << "'\n\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool StreamProcessor::addChain(const std::vector<std::string>& tokens) {
+    std::vector<std::string> command;
+
+    for (size_t i = 0; i <= tokens.size(); i++) {
+        if (i == tokens.size() || tokens[i] == ";") {
+            if (!command.empty() && !addCommand(command)) {
+                return false;
+            }
+            command.clear();
+        } else if (tokens[i].back() == ';') {
+            // Separator attached to the last argument, eg. "g 2; eq ..."
+            command.push_back(tokens[i].substr(0, tokens[i].size() - 1));
+            if (!addCommand(command)) {
+                return false;
+            }
+            command.clear();
+        } else {
+            command.push_back(tokens[i]);
+        }
+    }
+
+    return true;
+}
+
+
+bool StreamProcessor::validParameters(const Op& op) {
+    if (op.type == Op::Type::Gain && (op.gain < 0.0f || op.gain > 255.0f)) {
+        std::cerr << "Error: Gain must be between 0 and 255\n\n";
+        return false;
+    }
+
+    if (op.type == Op::Type::Equaliser) {
+        if (op.gains.size() != 5) {
+            std::cerr << "Error: Equaliser needs 5 gains\n\n";
+            return false;
+        }
+
+        for (float g : op.gains) {
+            if (g < 0.0f || g > 255.0f) {
+                std::cerr << "Error: Gain must be between 0 and 255\n\n";
+                return false;
+            }
+        }
+    }
+
+    if (op.type == Op::Type::Compression) {
+        if (op.threshold < 0.0f || op.threshold > 1.0f) {
+            std::cerr << "Error: Threshold must be between 0.0 and 1.0\n\n";
+            return false;
+        }
+
+        if (op.ratio <= 0) {
+            std::cerr << "Error: Ratio must be greater than 1\n\n";
+            return false;
+        }
+
+        if (op.makeUpGain < 1.0f || op.makeUpGain > 3.0f) {
+            std::cerr << "Error: Make-up gain must be between 1.0 and 3.0\n\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool StreamProcessor::resolveChain(uint32_t sampleRate, uint16_t channels, size_t frames) {
+    numChannels = channels;
+    numFrames = frames;
+    ranges.clear();
+    selections.clear();
+
+    // Same duration as AudioProcessor so that default end indices match
+    float totalDuration = static_cast<float>(frames) / sampleRate;
+
+    for (Op& op : chain) {
+        float endDuration = op.endDuration < 0.0f ? totalDuration : op.endDuration;
+
+        // Compression runs on every channel
+        ChannelMask selected = selectChannels(op.type == Op::Type::Compression ? ALL_CHANNELS : op.channels, channels);
+        if (!selected) {
+            return false;
+        }
+        selections.push_back(selected);
+
+        if (!validParameters(op)) {
+            return false;
+        }
+
+        if (op.startDuration < 0.0f || op.startDuration > totalDuration) {
+            std::cerr << "Error: Start duration must be between 0 and " << totalDuration << " sec\n\n";
+            return false;
+        }
+
+        if (endDuration < 0.0f || endDuration > totalDuration) {
+            std::cerr << "Error: End duration must be between 0 and " << totalDuration << " sec\n\n";
+            return false;
+        }
+
+        if (op.startDuration > endDuration) {
+            std::cerr << "Error: Start duration must be before end duration\n\n";
+            return false;
+        }
+
+        int startIndex = op.startDuration * sampleRate;
+        if (frames == UNBOUNDED && op.endDuration < 0.0f) {
+            ranges.emplace_back(startIndex, UNBOUNDED);
+            continue;
+        }
+
+        int endIndex = endDuration * sampleRate;
+        ranges.emplace_back(startIndex, std::min(static_cast<size_t>(endIndex), frames));
+    }
+
+    return true;
+}
+
+
+bool StreamProcessor::loadImpulseResponses(uint32_t sampleRate) {
+    // Impulse responses are partitioned by the block size, a mono one shared by every channel
+    irSpectra.assign(chain.size(), {});
+    for (size_t i = 0; i < chain.size(); i++) {
+        if (chain[i].type != Op::Type::Convolution) continue;
+
+        if ((blockSize & (blockSize - 1)) != 0 || blockSize < 2) {
+            std::cerr << "Error: Convolution needs a power of 2 block size\n\n";
+            return false;
+        }
+
+        AudioProcessor ir;
+        ir.load(chain[i].irFile);
+        if (ir.getChannel(0).empty()) {
+            std::cerr << "Error: Impulse response is empty\n\n";
+            return false;
+        }
+        if (ir.getHeader().sampleRate != sampleRate) {
+            std::cerr << "Error: Impulse response is at " << ir.getHeader().sampleRate << " Hz but audio is at "
+                      << sampleRate << " Hz\n\n";
+            return false;
+        }
+
+        irSpectra[i] = impulseResponseSpectra(ir, selections[i], numChannels, blockSize);
+        if (irSpectra[i].empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void StreamProcessor::process(const std::string& inputFile, const std::string& outputFile) {
+    std::fstream inFile(inputFile, std::ios::in | std::ios::binary);
+    if (!inFile) {
+        throw std::runtime_error("Unable to open file: " + inputFile + "\n");
+    }
+
+    AudioProcessor::WavHeader header;
+    std::vector<char> listData;
+    uint64_t dataSize = AudioProcessor::readWavHeader(inFile, header, listData);
+
+    // A truncated file keeps the frames it has, the same as when it is loaded
+    const std::streamoff position = inFile.tellg();
+    inFile.seekg(0, std::ios::end);
+    const uint64_t available = std::min<uint64_t>(dataSize, inFile.tellg() - position);
+    inFile.seekg(position);
+
+    const PcmCodec* codec = findPcmCodec(header.audioFormat, header.bitsPerSample);
+    size_t frames = available / codec->bytes / header.numChannels;
+    if (!resolveChain(header.sampleRate, header.numChannels, frames)) {
+        return;
+    }
+
+    equaliserBands = &designBands(EQUALISER_LAYOUT, header.sampleRate);
+
+    if (!loadImpulseResponses(header.sampleRate)) {
+        return;
+    }
+
+    std::fstream outFile(outputFile, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!outFile) {
+        throw std::runtime_error("Unable to open output file: " + outputFile);
+    }
+
+    const uint64_t outputSize = frames * numChannels * codec->bytes;
+    AudioProcessor::writeWavHeader(outFile, header, outputSize);
+
+    PcmRegion input = {&inFile, inFile.tellg(), codec};
+    PcmRegion output = {&outFile, outFile.tellp(), codec};
+
+    // Equalisers need the whole forward pass before the backward pass can start,
+    // so each one spills its band outputs into a temporary file. Convolutions carry
+    // their history forwards, so they cannot share the backward pass of an equaliser.
+    std::vector<size_t> stages;
+    bool equalised = false;
+    for (size_t i = 0; i < chain.size(); i++) {
+        if (chain[i].type == Op::Type::Equaliser || chain[i].type == Op::Type::Convolution) stages.push_back(i);
+        if (chain[i].type == Op::Type::Equaliser) equalised = true;
+    }
+
+    if (stages.empty()) {
+        pointwisePass(0, chain.size(), input, output);
+    } else {
+        std::random_device rd;
+        std::string tag = std::to_string(rd()) + std::to_string(rd());
+        TemporaryFile spill(std::filesystem::temp_directory_path() / ("eq_spill_" + tag + ".raw"));
+        TemporaryFile temp(std::filesystem::temp_directory_path() / ("eq_stage_" + tag + ".raw"));
+
+        if ((equalised && !spill.open()) || (stages.size() > 1 && !temp.open())) {
+            throw std::runtime_error("Unable to open temporary file in " + std::filesystem::temp_directory_path().string());
+        }
+
+        // Intermediate float results between stages go to a temporary file,
+        // which is safe to read and write in place since each pass reads src fully before writing dst
+        PcmRegion stage = {&temp.stream, 0, nullptr};
+        PcmRegion src = input;
+        size_t first = 0;
+
+        for (size_t i = 0; i < stages.size(); i++) {
+            bool lastStage = i + 1 == stages.size();
+            size_t last = lastStage ? chain.size() : stages[i + 1];
+            PcmRegion dst = lastStage ? output : stage;
+
+            if (chain[stages[i]].type == Op::Type::Equaliser) {
+                equaliserPass(first, stages[i], last, src, dst, spill.stream);
+            } else {
+                convolutionPass(first, stages[i], last, src, dst);
+            }
+
+            src = dst;
+            first = last;
+        }
+    }
+
+    // Chunks are padded to an even size
+    if (outputSize % 2) {
+        outFile.seekp(output.offset + static_cast<std::streamoff>(outputSize));
+        outFile.put(0);
+    }
+
+    if (!outFile) {
+        throw std::runtime_error("Failed to write output file: " + outputFile);
+    }
+
+    std::cout << "Streamed " << inputFile << " to " << outputFile << " in blocks of " << blockSize << " frames\n\n";
+}
+
+
+bool StreamProcessor::processPipe(std::FILE* in, std::FILE* out, uint32_t sampleRate, uint16_t channels,
+                                  const std::string& controlFile) {
+    if (channels < 1 || channels > MAX_CHANNELS) {
+        std::cerr << "Error: Unsupported number of channels (1 to 64).\n\n";
+        return false;
+    }
+
+    if (!resolveChain(sampleRate, channels, UNBOUNDED) || !loadImpulseResponses(sampleRate)) {
+        return false;
+    }
+
+    // Equalisers become their causal FIR, so every stateful stage is a convolution
+    std::vector<LiveParams> initial(chain.size());
+    for (size_t k = 0; k < chain.size(); k++) {
+        initial[k].gain = chain[k].gain;
+        initial[k].threshold = chain[k].threshold;
+        initial[k].ratio = chain[k].ratio;
+        initial[k].makeUpGain = chain[k].makeUpGain;
+        if (chain[k].type != Op::Type::Equaliser) continue;
+
+        if ((blockSize & (blockSize - 1)) != 0 || blockSize < 2) {
+            std::cerr << "Error: Streamed equalisers need a power of 2 block size\n\n";
+            return false;
+        }
+        // Not cached, so it is freed once live updates replace it. The pipe holds on to it
+        // in initial, so that happens after streaming rather than on the audio thread.
+        auto taps = causalEqualiserTaps(designBands(EQUALISER_LAYOUT, sampleRate), chain[k].gains);
+        initial[k].response = std::make_shared<const IrSpectrum>(taps, blockSize);
+        irSpectra[k].assign(numChannels, initial[k].response);
+    }
+
+    // Per channel state of each stage, allocated up front
+    std::vector<std::vector<std::unique_ptr<Convolver>>> convolvers(chain.size());
+    for (size_t k = 0; k < chain.size(); k++) {
+        const Op& op = chain[k];
+        for (size_t c = 0; c < numChannels; c++) {
+            bool selected = selections[k] >> c & 1;
+            bool stateful = op.type == Op::Type::Equaliser || op.type == Op::Type::Convolution;
+            convolvers[k].emplace_back(selected && stateful ? std::make_unique<Convolver>(irSpectra[k][c]) : nullptr);
+        }
+    }
+
+    // Live parameters, ramping towards the newest snapshot from the control thread
+    const size_t rampFrames = std::max<size_t>(PARAM_RAMP_SECONDS * sampleRate, 1);
+    std::vector<ParamRamp> gains, thresholds, makeUpGains;
+    std::vector<int> ratios;
+    std::vector<std::shared_ptr<const IrSpectrum>> responses;
+    for (const LiveParams& params : initial) {
+        gains.emplace_back(params.gain);
+        thresholds.emplace_back(params.threshold);
+        makeUpGains.emplace_back(params.makeUpGain);
+        ratios.push_back(params.ratio);
+        responses.push_back(params.response);
+    }
+
+    std::shared_ptr<ControlChannel> control;
+    if (!controlFile.empty()) {
+        control = std::make_shared<ControlChannel>(initial);
+        // Commands are matched to the chain by the channels they resolve to
+        control->chain = chain;
+        for (size_t k = 0; k < chain.size(); k++) {
+            control->chain[k].channels = selections[k];
+        }
+        control->sampleRate = sampleRate;
+        control->numChannels = numChannels;
+        control->blockSize = blockSize;
+        std::thread(controlLoop, control, controlFile).detach();
+    }
+
+    const PcmCodec& codec = *findPcmCodec(WAVE_FORMAT_PCM, 16);
+    std::vector<std::vector<float>> block(numChannels, std::vector<float>(blockSize));
+    pcm.resize(blockSize * numChannels * codec.bytes);
+
+    // Blocks never outgrow their capacity, so the channels stay where they are
+    float* planar[MAX_CHANNELS];
+    for (size_t c = 0; c < numChannels; c++) {
+        planar[c] = block[c].data();
+    }
+
+    const size_t frameBytes = numChannels * codec.bytes;
+    size_t offset = 0;
+    size_t numBlocks = 0;
+    std::chrono::duration<double, std::micro> slowest(0), total(0);
+
+    while (true) {
+        // A trailing partial frame is dropped
+        size_t frames = std::fread(pcm.data(), 1, blockSize * frameBytes, in) / frameBytes;
+        if (frames == 0) break;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (control && control->params.update()) {
+            const std::vector<LiveParams>& next = control->params.front();
+            for (size_t k = 0; k < chain.size(); k++) {
+                gains[k].start(next[k].gain, rampFrames);
+                thresholds[k].start(next[k].threshold, rampFrames);
+                makeUpGains[k].start(next[k].makeUpGain, rampFrames);
+                ratios[k] = next[k].ratio;
+                responses[k] = next[k].response;
+            }
+        }
+
+        for (size_t c = 0; c < numChannels; c++) {
+            block[c].resize(frames);
+        }
+        codec.deinterleave(pcm.data(), frames, numChannels, planar);
+
+        for (size_t k = 0; k < chain.size(); k++) {
+            const Op& op = chain[k];
+
+            // Part of [startIndex, endIndex) that falls in this block
+            size_t first = std::min(std::max(ranges[k].first, offset), offset + frames) - offset;
+            size_t last = std::max(std::min(ranges[k].second, offset + frames), offset) - offset;
+
+            for (size_t c = 0; c < numChannels; c++) {
+                Convolver* convolver = convolvers[k][c].get();
+                if (!convolver) continue;
+
+                // A new equaliser response fades in once the previous one has
+                if (op.type == Op::Type::Equaliser && !convolver->fading() && convolver->response() != responses[k].get()) {
+                    convolver->crossfade(responses[k], rampFrames);
+                }
+                convolver->process(block[c].data(), block[c].data(), frames);
+            }
+
+            if (op.type == Op::Type::Gain) {
+                ParamRamp& gain = gains[k];
+                bool ramping = gain.ramping();
+
+                for (size_t c = 0; c < numChannels && !ramping; c++) {
+                    if (selections[k] >> c & 1) {
+                        scaleSamples(std::span(block[c]).subspan(first, last - first), gain.current());
+                    }
+                }
+
+                // A ramp ending part way through the block holds its target for the rest
+                for (size_t i = 0; i < frames && ramping; i++) {
+                    float g = gain.next();
+                    for (size_t c = 0; c < numChannels && i >= first && i < last; c++) {
+                        if (selections[k] >> c & 1) {
+                            block[c][i] *= g;
+                        }
+                    }
+                }
+            } else if (op.type == Op::Type::Compression) {
+                ParamRamp& threshold = thresholds[k];
+                ParamRamp& makeUpGain = makeUpGains[k];
+                bool ramping = threshold.ramping() || makeUpGain.ramping();
+
+                for (size_t c = 0; c < numChannels && !ramping; c++) {
+                    compressSamples(std::span(block[c]).subspan(first, last - first), threshold.current(), ratios[k], makeUpGain.current());
+                }
+
+                for (size_t i = 0; i < frames && ramping; i++) {
+                    float t = threshold.next();
+                    float m = makeUpGain.next();
+                    for (size_t c = 0; c < numChannels && i >= first && i < last; c++) {
+                        compressSamples(std::span(block[c]).subspan(i, 1), t, ratios[k], m);
+                    }
+                }
+            }
+        }
+
+        AudioProcessor::interleaveSamples(codec, planar, frames, numChannels, pcm.data());
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        slowest = std::max(slowest, std::chrono::duration<double, std::micro>(elapsed));
+        total += elapsed;
+
+        if (std::fwrite(pcm.data(), frameBytes, frames, out) != frames || std::fflush(out) != 0) {
+            throw std::runtime_error("Failed to write output stream\n");
+        }
+
+        offset += frames;
+        numBlocks++;
+    }
+
+    // Report on stderr, stdout carries the audio
+    std::cerr << "Streamed " << offset << " frames in blocks of " << blockSize << " frames, "
+              << "processing took " << (numBlocks ? total.count() / numBlocks : 0.0) << " us per block on average, "
+              << slowest.count() << " us at most\n";
+
+    return true;
+}
+
+
+void StreamProcessor::controlLoop(std::shared_ptr<ControlChannel> control, std::string controlFile) {
+    // A named pipe is reopened whenever its writer closes it, a regular file is read once
+    bool fifo = std::filesystem::is_fifo(controlFile);
+
+    do {
+        std::ifstream commands(controlFile);
+        if (!commands) {
+            std::cerr << "Error: Unable to open control file: " << controlFile << "\n\n";
+            return;
+        }
+
+        std::string line;
+        while (std::getline(commands, line)) {
+            std::istringstream words(line);
+            std::vector<std::string> argv{std::istream_iterator<std::string>(words), std::istream_iterator<std::string>()};
+            if (argv.empty()) continue;
+
+            Op op;
+            if (!parseCommand(argv, op) || !validParameters(op)) continue;
+            if (op.type == Op::Type::Convolution) {
+                std::cerr << "Error: Only g, eq and drc can change while streaming\n\n";
+                continue;
+            }
+
+            // Resolved the same way as the chain, so 'b' on a mono stream matches 'l'
+            if (op.type != Op::Type::Compression) {
+                op.channels = selectChannels(op.channels, control->numChannels);
+                if (!op.channels) continue;
+            }
+
+            // Built here rather than through the spectrum cache, so it is freed once no
+            // snapshot or convolver holds it, by this thread when it prunes the retained list
+            std::shared_ptr<const IrSpectrum> response;
+            if (op.type == Op::Type::Equaliser) {
+                auto taps = causalEqualiserTaps(designBands(EQUALISER_LAYOUT, control->sampleRate), op.gains);
+                response = std::make_shared<const IrSpectrum>(taps, control->blockSize);
+            }
+
+            // Every command of the same type on the same channels takes the new parameters
+            bool matched = false;
+            for (size_t k = 0; k < control->chain.size(); k++) {
+                const Op& target = control->chain[k];
+                if (target.type != op.type) continue;
+                if (op.type != Op::Type::Compression && target.channels != op.channels) continue;
+
+                LiveParams& params = control->latest[k];
+                params.gain = op.gain;
+                params.threshold = op.threshold;
+                params.ratio = op.ratio;
+                params.makeUpGain = op.makeUpGain;
+                if (op.type == Op::Type::Equaliser) {
+                    params.response = response;
+                }
+                matched = true;
+            }
+
+            if (!matched) {
+                std::cerr << "Error: No '" << argv[0] << "' on those channels in the chain\n\n";
+                continue;
+            }
+
+            if (response) {
+                control->retained.push_back(response);
+            }
+            control->params.back() = control->latest;
+            control->params.publish();
+
+            // Responses nothing else holds any more are freed here, never on the audio thread
+            std::erase_if(control->retained, [](const auto& held) { return held.use_count() == 1; });
+            std::cerr << "Updated: " << line << "\n";
+        }
+    } while (fifo);
+}
+
+
+bool StreamProcessor::apply(AudioProcessor& audio) {
+    audio.evaluate();
+
+    const AudioProcessor::WavHeader& header = audio.getHeader();
+    if (!resolveChain(header.sampleRate, header.numChannels, audio.storedFrames())) {
+        return false;
+    }
+
+    equaliserBands = &audio.equaliserBands;
+
+    if (!loadImpulseResponses(header.sampleRate)) {
+        return false;
+    }
+
+    // The whole file is one block, so stateful stages run over the channels directly
+    std::vector<std::vector<float>> channels = std::move(audio.channels);
+
+    size_t first = 0;
+    for (size_t k = 0; k < chain.size(); k++) {
+        const Op& op = chain[k];
+        if (op.type != Op::Type::Equaliser && op.type != Op::Type::Convolution) continue;
+
+        applyPointwise(first, k, channels, 0);
+        first = k + 1;
+
+        std::vector<float*> selected;
+        std::vector<std::shared_ptr<const IrSpectrum>> irs;
+        for (size_t c = 0; c < numChannels; c++) {
+            if (selections[k] >> c & 1) {
+                selected.push_back(channels[c].data());
+                if (op.type == Op::Type::Convolution) irs.push_back(irSpectra[k][c]);
+            }
+        }
+
+        if (op.type == Op::Type::Equaliser) {
+            equaliseChannels(selected, numFrames, *equaliserBands, op.gains, EqEngine::IIR, audio.scratch);
+        } else {
+            convolveChannels(selected, numFrames, irs);
+        }
+    }
+    applyPointwise(first, chain.size(), channels, 0);
+
+    audio.channels = std::move(channels);
+
+    return true;
+}
+
+
+void StreamProcessor::readBlock(PcmRegion src, size_t frameOffset, size_t frames, std::vector<std::vector<float>>& block) {
+    float* outputs[MAX_CHANNELS];
+    block.resize(numChannels);
+    for (size_t c = 0; c < numChannels; c++) {
+        block[c].resize(frames);
+        outputs[c] = block[c].data();
+    }
+
+    if (src.codec) {
+        pcm.resize(frames * numChannels * src.codec->bytes);
+
+        src.file->seekg(src.offset + static_cast<std::streamoff>(frameOffset * numChannels * src.codec->bytes));
+        if (!src.file->read(pcm.data(), pcm.size())) {
+            // Short data chunk, treat missing samples as silence, which unsigned 8-bit keeps at 128
+            std::fill(pcm.begin() + src.file->gcount(), pcm.end(), static_cast<char>(src.codec->bitsPerSample == 8 ? 128 : 0));
+            src.file->clear();
+        }
+
+        src.codec->deinterleave(pcm.data(), frames, numChannels, outputs);
+        return;
+    }
+
+    interleaved.resize(frames * numChannels);
+    src.file->seekg(src.offset + static_cast<std::streamoff>(frameOffset * numChannels * sizeof(float)));
+    src.file->read(reinterpret_cast<char*>(interleaved.data()), interleaved.size() * sizeof(float));
+
+    for (size_t c = 0; c < numChannels; c++) {
+        for (size_t i = 0; i < frames; i++) {
+            outputs[c][i] = interleaved[i * numChannels + c];
+        }
+    }
+}
+
+
+void StreamProcessor::writeBlock(PcmRegion dst, size_t frameOffset, const std::vector<std::vector<float>>& block) {
+    size_t frames = block[0].size();
+    const float* inputs[MAX_CHANNELS];
+    for (size_t c = 0; c < numChannels; c++) {
+        inputs[c] = block[c].data();
+    }
+
+    if (dst.codec) {
+        pcm.resize(frames * numChannels * dst.codec->bytes);
+        AudioProcessor::interleaveSamples(*dst.codec, inputs, frames, numChannels, pcm.data());
+
+        dst.file->seekp(dst.offset + static_cast<std::streamoff>(frameOffset * numChannels * dst.codec->bytes));
+        dst.file->write(pcm.data(), pcm.size());
+        return;
+    }
+
+    interleaved.resize(frames * numChannels);
+    for (size_t c = 0; c < numChannels; c++) {
+        for (size_t i = 0; i < frames; i++) {
+            interleaved[i * numChannels + c] = inputs[c][i];
+        }
+    }
+
+    dst.file->seekp(dst.offset + static_cast<std::streamoff>(frameOffset * numChannels * sizeof(float)));
+    dst.file->write(reinterpret_cast<const char*>(interleaved.data()), interleaved.size() * sizeof(float));
+}
+
+
+void StreamProcessor::applyPointwise(size_t first, size_t last, std::vector<std::vector<float>>& block, size_t frameOffset) {
+    size_t frames = block[0].size();
+
+    for (size_t k = first; k < last; k++) {
+        const Op& op = chain[k];
+
+        // Part of [startIndex, endIndex) that falls in this block
+        size_t start = std::max(ranges[k].first, frameOffset);
+        size_t end = std::min(ranges[k].second, frameOffset + frames);
+        if (start >= end) continue;
+
+        for (size_t c = 0; c < numChannels; c++) {
+            float* data = block[c].data() + (start - frameOffset);
+
+            if (op.type == Op::Type::Gain) {
+                if (selections[k] >> c & 1) {
+                    scaleSamples({data, end - start}, op.gain);
+                }
+            } else if (op.type == Op::Type::Compression) {
+                compressSamples({data, end - start}, op.threshold, op.ratio, op.makeUpGain);
+            }
+        }
+    }
+}
+
+
+void StreamProcessor::pointwisePass(size_t first, size_t last, PcmRegion src, PcmRegion dst) {
+    std::vector<std::vector<float>> block;
+
+    for (size_t offset = 0; offset < numFrames; offset += blockSize) {
+        size_t frames = std::min(blockSize, numFrames - offset);
+        readBlock(src, offset, frames, block);
+        applyPointwise(first, last, block, offset);
+        writeBlock(dst, offset, block);
+    }
+}
+
+
+void StreamProcessor::equaliserPass(size_t first, size_t eq, size_t last, PcmRegion src, PcmRegion dst, std::fstream& spill) {
+    const Op& op = chain[eq];
+
+    // Spill layout per block: planar band outputs for each equalised channel, the
+    // untouched samples for the others, every slot holding up to blockSize frames
+    std::vector<bool> selected(numChannels);
+    size_t numSelected = 0;
+    for (size_t c = 0; c < numChannels; c++) {
+        selected[c] = selections[eq] >> c & 1;
+        numSelected += selected[c];
+    }
+    const std::streamoff blockBytes = (numSelected * EQ_BANDS + numChannels - numSelected) * blockSize * sizeof(float);
+
+    // One bank filters every equalised channel side by side, carrying their history across blocks
+    EqualiserBank bank(*equaliserBands, 0, EQ_BANDS, numSelected);
+
+    std::vector<std::vector<float>> block;
+    std::vector<float> bands(numSelected * blockSize * EQ_BANDS);
+    std::vector<const float*> inputs(numSelected);
+    std::vector<float*> outputs(numSelected);
+    for (size_t s = 0; s < numSelected; s++) {
+        outputs[s] = bands.data() + s * blockSize * EQ_BANDS;
+    }
+
+    // Forward pass
+    for (size_t offset = 0; offset < numFrames; offset += blockSize) {
+        size_t frames = std::min(blockSize, numFrames - offset);
+        readBlock(src, offset, frames, block);
+        applyPointwise(first, eq, block, offset);
+
+        for (size_t c = 0, s = 0; c < numChannels; c++) {
+            if (selected[c]) inputs[s++] = block[c].data();
+        }
+        bank.forward(inputs.data(), outputs.data(), frames);
+
+        spill.seekp((offset / blockSize) * blockBytes);
+        for (size_t c = 0, s = 0; c < numChannels; c++) {
+            if (!selected[c]) {
+                spill.write(reinterpret_cast<const char*>(block[c].data()), frames * sizeof(float));
+                continue;
+            }
+
+            spill.write(reinterpret_cast<const char*>(outputs[s++]), frames * EQ_BANDS * sizeof(float));
+        }
+    }
+
+    if (!spill) {
+        throw std::runtime_error("Failed to write equaliser spill file\n");
+    }
+
+    // Backward pass, last block first
+    size_t numBlocks = (numFrames + blockSize - 1) / blockSize;
+    for (size_t k = numBlocks; k-- > 0;) {
+        size_t offset = k * blockSize;
+        size_t frames = std::min(blockSize, numFrames - offset);
+
+        block.resize(numChannels);
+        spill.seekg(k * blockBytes);
+        for (size_t c = 0, s = 0; c < numChannels; c++) {
+            block[c].resize(frames);
+
+            if (!selected[c]) {
+                spill.read(reinterpret_cast<char*>(block[c].data()), frames * sizeof(float));
+                continue;
+            }
+
+            spill.read(reinterpret_cast<char*>(outputs[s++]), frames * EQ_BANDS * sizeof(float));
+        }
+
+        if (!spill) {
+            throw std::runtime_error("Failed to read equaliser spill file\n");
+        }
+
+        bank.backward(outputs.data(), frames, op.gains);
+        for (size_t c = 0, s = 0; c < numChannels; c++) {
+            if (selected[c]) {
+                EqualiserBank::sumBands(outputs[s++], frames, block[c].data(), frames);
+            }
+        }
+
+        applyPointwise(eq + 1, last, block, offset);
+        writeBlock(dst, offset, block);
+    }
+}
+
+
+void StreamProcessor::convolutionPass(size_t first, size_t conv, size_t last, PcmRegion src, PcmRegion dst) {
+    // Each selected channel carries its own history across blocks
+    std::vector<std::unique_ptr<Convolver>> convolvers(numChannels);
+    for (size_t c = 0; c < numChannels; c++) {
+        if (selections[conv] >> c & 1) {
+            convolvers[c] = std::make_unique<Convolver>(irSpectra[conv][c]);
+        }
+    }
+
+    std::vector<std::vector<float>> block;
+
+    for (size_t offset = 0; offset < numFrames; offset += blockSize) {
+        size_t frames = std::min(blockSize, numFrames - offset);
+        readBlock(src, offset, frames, block);
+        applyPointwise(first, conv, block, offset);
+
+        for (size_t c = 0; c < numChannels; c++) {
+            if (convolvers[c]) {
+                convolvers[c]->process(block[c].data(), block[c].data(), frames);
+            }
+        }
+
+        applyPointwise(conv + 1, last, block, offset);
+        writeBlock(dst, offset, block);
+    }
+}
@@ -0,0 +1,181 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+
+#include "dsp.h"
+#include "params.h"
+
+
+// Number of frames read, processed and written at a time
+constexpr size_t DEFAULT_STREAM_BLOCK_SIZE = 4096;
+
+// Frames per block of raw PCM pipes, small to keep latency low
+constexpr size_t DEFAULT_PIPE_BLOCK_SIZE = 256;
+
+// Time over which live parameter changes ramp in, in seconds
+constexpr float PARAM_RAMP_SECONDS = 0.01f;
+
+
+class StreamProcessor {
+public:
+
+    // One stage of the processing chain
+    struct Op {
+        enum class Type { Gain, Equaliser, Compression, Convolution };
+
+        Type type;
+        ChannelMask channels = ALL_CHANNELS;    // Channel selection, eg. LEFT_CHANNEL
+        float gain = 1.0f;              // Gain, 0 - 255 scale
+        std::vector<float> gains;       // Equaliser gains
+        float threshold = 0.7f;         // Compression threshold
+        int ratio = 2;                  // Compression ratio
+        float makeUpGain = 1.0f;        // Compression make-up gain
+        float startDuration = 0.0f;     // in seconds
+        float endDuration = -1.0f;      // in seconds, negative for end of file
+        std::string irFile;             // Impulse response .wav file
+    };
+
+    // Constructors
+    explicit StreamProcessor(size_t blockSize = DEFAULT_STREAM_BLOCK_SIZE);
+
+    /// @brief Adds an operation to the chain using the REPL command syntax
+    /// @param argv tokens of one command, eg. {"eq", "1", "2", "1", "1", "1"}
+    /// @return false if the command is invalid
+    bool addCommand(const std::vector<std::string>& argv);
+
+    /// @brief Adds every ';' separated command of a chain to the processing chain
+    /// @param tokens tokens of the chain, eg. {"g", "2", ";", "drc", "0.5"}
+    /// @return false if any command is invalid
+    bool addChain(const std::vector<std::string>& tokens);
+
+    /// @brief Streams a .wav file through the chain block by block
+    /// @param inputFile 16-bit PCM .wav file to read
+    /// @param outputFile .wav file to write
+    void process(const std::string& inputFile, const std::string& outputFile);
+
+    /// @brief Streams raw interleaved 16-bit PCM through the chain until the input ends,
+    /// writing each block as soon as it is processed. Equalisers run as causalEqualiserTaps
+    /// since the stream has no end to run backwards from. Nothing is allocated per block,
+    /// so every block takes about the same time.
+    /// @param in raw PCM to read, eg. stdin
+    /// @param out raw PCM to write, eg. stdout
+    /// @param sampleRate in Hz
+    /// @param channels 1 to MAX_CHANNELS
+    /// @param controlFile file or named pipe of g, eq and drc commands that change the parameters
+    /// of the matching commands in the chain while audio flows, empty for none. Commands are read
+    /// on their own thread and handed over without locks, and changes ramp in sample by sample.
+    /// @return false if the chain does not suit the stream
+    bool processPipe(std::FILE* in, std::FILE* out, uint32_t sampleRate, uint16_t channels,
+                     const std::string& controlFile = "");
+
+    /// @brief Runs the chain over a file already in memory, with the same results as streaming
+    /// it. Reports nothing on stdout, so copies of a processor can run on many files at once.
+    /// @param audio file to process in place
+    /// @return false if the chain does not suit the file
+    bool apply(AudioProcessor& audio);
+
+    const std::vector<Op>& getChain() const { return chain; }
+    size_t getBlockSize() const { return blockSize; }
+
+private:
+    // Parameters of one operation that can change while a pipe is running
+    struct LiveParams {
+        float gain = 1.0f;
+        std::shared_ptr<const IrSpectrum> response;     // Causal equaliser taps
+        float threshold = 0.7f;
+        int ratio = 2;
+        float makeUpGain = 1.0f;
+    };
+
+    // State shared with the control thread, which outlives the pipe if it is still
+    // waiting for a command when the input ends
+    struct ControlChannel {
+        explicit ControlChannel(const std::vector<LiveParams>& initial) : params(initial), latest(initial) {}
+
+        TripleBuffer<std::vector<LiveParams>> params;   // Control thread to audio thread
+        std::vector<LiveParams> latest;                 // Control thread only
+        // Control thread only, every response published, so the audio thread never drops the
+        // last reference and frees one in the middle of a block
+        std::vector<std::shared_ptr<const IrSpectrum>> retained;
+        std::vector<Op> chain;
+        uint32_t sampleRate = 0;
+        uint16_t numChannels = 0;
+        size_t blockSize = 0;
+    };
+
+    /// @brief Control thread of a pipe, publishes a snapshot for every valid command read
+    static void controlLoop(std::shared_ptr<ControlChannel> control, std::string controlFile);
+
+    // Interleaved samples stored in a file from a byte offset, either in the format of
+    // a codec or, without one, float working samples for intermediate results
+    struct PcmRegion {
+        std::fstream* file;
+        std::streamoff offset;
+        const PcmCodec* codec;
+    };
+
+    /// @brief Parses one command using the REPL command syntax
+    /// @param argv tokens of one command
+    /// @param op operation to fill
+    /// @return false if the command is invalid
+    static bool parseCommand(const std::vector<std::string>& argv, Op& op);
+
+    /// @brief Checks the gains, threshold, ratio and make-up gain of an operation are in range
+    static bool validParameters(const Op& op);
+
+    /// @brief Validates the chain against the file and resolves durations to sample indices
+    /// @param numFrames frames in the file, or UNBOUNDED for a stream without an end
+    /// @return false if any operation is out of range
+    bool resolveChain(uint32_t sampleRate, uint16_t numChannels, size_t numFrames);
+
+    /// @brief Loads and transforms the impulse response of every convolution in the chain
+    /// @return false if a response does not suit the stream
+    bool loadImpulseResponses(uint32_t sampleRate);
+
+    static constexpr size_t UNBOUNDED = SIZE_MAX;
+
+    /// @brief Applies the point-wise operations [first, last) of the chain to a block
+    void applyPointwise(size_t first, size_t last, std::vector<std::vector<float>>& block, size_t frameOffset);
+
+    /// @brief Single forward pass of point-wise operations [first, last) from src to dst
+    void pointwisePass(size_t first, size_t last, PcmRegion src, PcmRegion dst);
+
+    /// @brief Forward pass of point-wise operations [first, eq) and the equaliser at chain[eq],
+    /// then backward pass of the equaliser and point-wise operations (eq, last) from src to dst
+    void equaliserPass(size_t first, size_t eq, size_t last, PcmRegion src, PcmRegion dst, std::fstream& spill);
+
+    /// @brief Forward pass of point-wise operations [first, conv), the convolution at chain[conv]
+    /// and point-wise operations (conv, last) from src to dst, partitioned by the block size
+    void convolutionPass(size_t first, size_t conv, size_t last, PcmRegion src, PcmRegion dst);
+
+    /// @brief Reads a block of interleaved frames from a region into planar channels
+    void readBlock(PcmRegion src, size_t frameOffset, size_t numFrames, std::vector<std::vector<float>>& block);
+
+    /// @brief Writes a block of planar channels as interleaved frames into a region
+    void writeBlock(PcmRegion dst, size_t frameOffset, const std::vector<std::vector<float>>& block);
+
+    size_t blockSize;
+    std::vector<Op> chain;
+
+    // Resolved per file
+    std::vector<std::pair<size_t, size_t>> ranges;  // [startIndex, endIndex) of each operation
+    std::vector<ChannelMask> selections;            // Channels present in the file that each operation runs on
+    uint16_t numChannels = 0;
+    size_t numFrames = 0;
+
+    std::vector<float> interleaved;                 // Block of interleaved float working samples
+    std::vector<char> pcm;                          // Same block in the file format
+
+    // Equaliser band filters for the file's sample rate, owned by the design cache
+    const std::vector<std::vector<Biquad>>* equaliserBands = nullptr;
+
+    // Impulse response spectrum of each channel for each convolution in the chain
+    std::vector<std::vector<std::shared_ptr<const IrSpectrum>>> irSpectra;
+};
+
+#endif
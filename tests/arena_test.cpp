@@ -0,0 +1,110 @@
+// Scratch arena alignment, scoped release and high-water mark, and DSP calls that reuse it
+//
+// Usage: arena_test
+
+#include <cstdint>
+#include <random>
+
+#include "../arena.h"
+#include "../dsp.h"
+#include "check.h"
+
+
+// Buffers are aligned and padded to ALIGNMENT, and a Scope gives back what was allocated in it
+static void testScopeRelease() {
+    ScratchArena arena;
+    ScratchArena::Scope outer(arena);
+
+    std::span<float> first = arena.allocate<float>(100);
+    CHECK(reinterpret_cast<uintptr_t>(first.data()) % ScratchArena::ALIGNMENT == 0);
+    CHECK(arena.highWaterMark() == 448);
+
+    void* released;
+    {
+        ScratchArena::Scope inner(arena);
+        released = arena.allocate<float>(1000).data();
+        CHECK(reinterpret_cast<uintptr_t>(released) % ScratchArena::ALIGNMENT == 0);
+    }
+
+    // The next buffer starts where the released one did, the mark stays at the most used
+    CHECK(arena.allocate<double>(10).data() == released);
+    CHECK(arena.highWaterMark() == 448 + 4032);
+    CHECK(arena.allocate<char>(0).empty());
+}
+
+
+// A call that outgrows the first block gets one block of its high-water mark once every
+// scope has ended, and repeating it allocates nothing
+static void testHighWaterMerge() {
+    ScratchArena arena;
+    auto call = [&arena] {
+        ScratchArena::Scope scope(arena);
+        arena.allocate<char>(1000);
+        arena.allocate<char>(5000);
+        arena.allocate<char>(20000);
+    };
+
+    call();
+    CHECK(arena.blockAllocations() == 3);
+    CHECK(arena.highWaterMark() == 1024 + 5056 + 20032);
+    CHECK(arena.capacity() == 0);
+
+    call();
+    CHECK(arena.blockAllocations() == 4);
+    CHECK(arena.capacity() == arena.highWaterMark());
+
+    for (int k = 0; k < 3; k++) {
+        call();
+    }
+    CHECK(arena.blockAllocations() == 4);
+    CHECK(arena.highWaterMark() == 1024 + 5056 + 20032);
+}
+
+
+// Filters and equalisers give their scratch back, so once the blocks of the first call are
+// merged, repeating it on the same arena allocates no more blocks
+static void testDspReusesArena() {
+    const size_t n = 100000;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> level(-0.5f, 0.5f);
+    std::vector<float> left(n), right(n);
+    for (size_t i = 0; i < n; i++) {
+        left[i] = level(rng);
+        right[i] = level(rng);
+    }
+    std::vector<float*> channels = {left.data(), right.data()};
+    const auto bands = designBands(EQUALISER_LAYOUT, 44100);
+    const std::vector<float> gains = {1.0f, 2.0f, 0.5f, 1.5f, 3.0f};
+    const std::vector<double> b = {0.2, 0.0, -0.2}, a = {1.0, -1.2, 0.6};
+
+    for (EqEngine engine : {EqEngine::IIR, EqEngine::FFT}) {
+        ScratchArena arena;
+        equaliseChannels(channels, n, bands, gains, engine, arena);
+        equaliseChannels(channels, n, bands, gains, engine, arena);
+        size_t allocations = arena.blockAllocations();
+        size_t peak = arena.highWaterMark();
+        CHECK(peak >= n * sizeof(float));
+        CHECK(arena.capacity() == peak);
+
+        equaliseChannels(channels, n, bands, gains, engine, arena);
+        equaliseChannels(channels, n, bands, gains, engine, arena);
+        CHECK(arena.blockAllocations() == allocations);
+        CHECK(arena.highWaterMark() == peak);
+    }
+
+    ScratchArena arena;
+    filtfiltChannels(channels, n, b, a, arena);
+    filtfiltChannels(channels, n, b, a, arena);
+    size_t allocations = arena.blockAllocations();
+    CHECK(allocations > 0);
+    filtfiltChannels(channels, n, b, a, arena);
+    CHECK(arena.blockAllocations() == allocations);
+}
+
+
+int main() {
+    RUN_TEST(testScopeRelease);
+    RUN_TEST(testHighWaterMerge);
+    RUN_TEST(testDspReusesArena);
+    return testResult();
+}
@@ -0,0 +1,466 @@
+// WAV chunk scanning, RF64 sizes and WAVE_FORMAT_EXTENSIBLE files, channel selections,
+// deferred command chains against the same chains run immediately, trim and reverse as
+// changes of the view over the stored samples, and the text dump against a plain formatter
+//
+// Usage: audio_test
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+#include "../audio.h"
+#include "../dsp.h"
+#include "../pool.h"
+#include "check.h"
+
+
+// Writes a 16-bit .wav file of random samples
+static void writeNoiseFile(const std::string& path, uint32_t sampleRate, uint16_t numChannels, size_t frames,
+                           std::mt19937& rng) {
+    std::vector<int16_t> samples(frames * numChannels);
+    for (int16_t& sample : samples) {
+        sample = static_cast<int16_t>(rng());
+    }
+
+    AudioProcessor::WavHeader header = {};
+    header.audioFormat = WAVE_FORMAT_PCM;
+    header.numChannels = numChannels;
+    header.sampleRate = sampleRate;
+    header.bitsPerSample = 16;
+    header.blockAlign = numChannels * sizeof(int16_t);
+    header.byteRate = header.sampleRate * header.blockAlign;
+
+    std::ofstream file(path, std::ios::binary);
+    AudioProcessor::writeWavHeader(file, header, samples.size() * sizeof(int16_t));
+    file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(int16_t));
+}
+
+
+// Keeps what the commands report on a stream out of the test output while it exists
+struct Silence {
+    explicit Silence(std::ostream& stream) : stream(stream), saved(stream.rdbuf(discarded.rdbuf())) {}
+    ~Silence() { stream.rdbuf(saved); }
+
+    std::ostream& stream;
+    std::ostringstream discarded;
+    std::streambuf* saved;
+};
+
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+// One random command of g, drc, t, rev or eq on all or some channels, the same on both processors
+static void runRandomCommand(AudioProcessor& immediate, AudioProcessor& deferred, std::mt19937& rng) {
+    auto uniform = [&rng](float low, float high) { return std::uniform_real_distribution<float>(low, high)(rng); };
+    const ChannelMask present = (ChannelMask(1) << immediate.getNumChannels()) - 1;
+    const ChannelMask sel = rng() % 2 ? ALL_CHANNELS : 1 + rng() % present;
+    const float duration = immediate.getDuration();
+    float start = uniform(0.0f, duration);
+    float end = uniform(start, duration);
+
+    switch (rng() % 6) {
+        case 0:
+        case 1: {
+            float gain = uniform(0.0f, 3.0f);
+            AudioProcessor::setDeferred(false);
+            volumeGain(immediate, gain, sel, start, end);
+            AudioProcessor::setDeferred(true);
+            volumeGain(deferred, gain, sel, start, end);
+            break;
+        }
+        case 2: {
+            float threshold = uniform(0.1f, 1.0f), makeUpGain = uniform(1.0f, 3.0f);
+            int ratio = 1 + rng() % 8;
+            AudioProcessor::setDeferred(false);
+            dynamicCompression(immediate, threshold, ratio, makeUpGain, start, end);
+            AudioProcessor::setDeferred(true);
+            dynamicCompression(deferred, threshold, ratio, makeUpGain, start, end);
+            break;
+        }
+        case 3:
+            AudioProcessor::setDeferred(false);
+            immediate.trimAudio(start, end);
+            AudioProcessor::setDeferred(true);
+            deferred.trimAudio(start, end);
+            break;
+        case 4:
+            AudioProcessor::setDeferred(false);
+            reverseAudio(immediate);
+            AudioProcessor::setDeferred(true);
+            reverseAudio(deferred);
+            break;
+        case 5: {
+            std::vector<float> gains(EQ_BANDS);
+            for (float& gain : gains) {
+                gain = uniform(0.5f, 2.0f);
+            }
+            AudioProcessor::setDeferred(false);
+            equaliser(immediate, gains, sel);
+            AudioProcessor::setDeferred(true);
+            equaliser(deferred, gains, sel);
+            break;
+        }
+    }
+    AudioProcessor::setDeferred(false);
+}
+
+
+// Canonical RIFF headers up to 4 GB of data, RF64 with a ds64 chunk past that
+static void testRf64Header() {
+    AudioProcessor::WavHeader header = {};
+    header.audioFormat = 1;
+    header.numChannels = 2;
+    header.sampleRate = 44100;
+    header.bitsPerSample = 16;
+    header.blockAlign = 4;
+    header.byteRate = 44100 * 4;
+
+    for (uint64_t dataSize : {uint64_t(4000), uint64_t(5000000000)}) {
+        std::stringstream file;
+        AudioProcessor::writeWavHeader(file, header, dataSize);
+        CHECK(file.str().size() == (dataSize > UINT32_MAX ? 80u : 44u));
+
+        AudioProcessor::WavHeader read;
+        std::vector<char> listData;
+        CHECK(AudioProcessor::readWavHeader(file, read, listData) == dataSize);
+        CHECK(std::string(read.chunkID, 4) == (dataSize > UINT32_MAX ? "RF64" : "RIFF"));
+        CHECK(read.numChannels == 2 && read.sampleRate == 44100 && read.bitsPerSample == 16);
+        CHECK(listData.empty());
+    }
+}
+
+
+// Files whose block align does not match the channels and sample size are rejected
+static void testBadBlockAlign() {
+    AudioProcessor::WavHeader header = {};
+    header.audioFormat = WAVE_FORMAT_PCM;
+    header.numChannels = 2;
+    header.sampleRate = 44100;
+    header.bitsPerSample = 16;
+    header.byteRate = 44100 * 4;
+
+    for (uint16_t blockAlign : {0, 3, 4}) {
+        header.blockAlign = blockAlign;
+        std::stringstream file;
+        AudioProcessor::writeWavHeader(file, header, 4000);
+
+        AudioProcessor::WavHeader read;
+        std::vector<char> listData;
+        bool rejected = false;
+        try {
+            Silence quiet(std::cerr);
+            AudioProcessor::readWavHeader(file, read, listData);
+        } catch (const std::runtime_error&) {
+            rejected = true;
+        }
+        CHECK(rejected == (blockAlign != 4));
+    }
+}
+
+
+// Appends a chunk and its pad byte if the size is odd
+static void appendChunk(std::string& file, const char* id, const std::string& data) {
+    uint32_t size = data.size();
+    file.append(id, 4);
+    file.append(reinterpret_cast<const char*>(&size), 4);
+    file += data;
+    if (size % 2) file += '\0';
+}
+
+
+// Chunks the reader has no use for are skipped in any order, with their pad bytes
+static void testChunkScan() {
+    const int16_t samples[] = {100, -200, 300, -400, 500, -600};
+    std::string fmt(18, '\0');     // PCM fields and an empty extension
+    const uint16_t fields[] = {1, 2, 8000, 0, 32000, 0, 4, 16};
+    std::memcpy(fmt.data(), fields, sizeof(fields));
+
+    std::string body = "WAVE";
+    appendChunk(body, "JUNK", std::string(3, 'j'));
+    appendChunk(body, "fmt ", fmt);
+    appendChunk(body, "bext", std::string(7, 'b'));
+    appendChunk(body, "LIST", "INFOabc");
+    appendChunk(body, "fact", std::string(4, 'f'));
+    appendChunk(body, "data", std::string(reinterpret_cast<const char*>(samples), sizeof(samples)));
+    std::string file;
+    appendChunk(file, "RIFF", body);
+
+    std::stringstream in(file);
+    AudioProcessor::WavHeader header;
+    std::vector<char> listData;
+    CHECK(AudioProcessor::readWavHeader(in, header, listData) == sizeof(samples));
+    CHECK(header.audioFormat == 1 && header.numChannels == 2 && header.sampleRate == 8000);
+    CHECK(header.blockAlign == 4 && header.bitsPerSample == 16);
+    CHECK(std::string(listData.begin(), listData.end()) == "INFOabc");
+
+    const std::string path = tempPath("audio_test_chunks.wav");
+    std::ofstream(path, std::ios::binary) << file;
+    AudioProcessor p;
+    p.load(path);
+    std::remove(path.c_str());
+    CHECK(p.getNumChannels() == 2);
+    for (size_t c = 0; c < p.getNumChannels(); c++) {
+        CHECK(p.getChannel(c) == std::vector<float>({samples[c] / 32768.0f, samples[c + 2] / 32768.0f, samples[c + 4] / 32768.0f}));
+    }
+}
+
+
+// WAVE_FORMAT_EXTENSIBLE files take their format from the subformat GUID
+static void testExtensibleFormat() {
+    const unsigned char samples[] = {0x00, 0x00, 0x80, 0xFF, 0xFF, 0x7F, 0x00, 0x00, 0x40, 0x00, 0x00, 0xC0};
+    const uint16_t fields[] = {WAVE_FORMAT_EXTENSIBLE, 2, 48000, 0, 0x6500, 0x4, 6, 24, 22, 24, 3, 0, WAVE_FORMAT_PCM};
+    std::string fmt(40, '\0');
+    std::memcpy(fmt.data(), fields, sizeof(fields));
+
+    std::string body = "WAVE";
+    appendChunk(body, "fmt ", fmt);
+    appendChunk(body, "data", std::string(reinterpret_cast<const char*>(samples), sizeof(samples)));
+    std::string file;
+    appendChunk(file, "RIFF", body);
+
+    const std::string path = tempPath("audio_test_extensible.wav");
+    std::ofstream(path, std::ios::binary) << file;
+    AudioProcessor p;
+    p.load(path);
+    std::remove(path.c_str());
+
+    CHECK(p.getHeader().audioFormat == WAVE_FORMAT_PCM && p.getHeader().bitsPerSample == 24);
+    CHECK(p.getHeader().channelMask == 3 && p.getNumChannels() == 2);
+    CHECK(p.getChannel(0) == std::vector<float>({-1.0f, 0.5f}));
+    CHECK(p.getNumChannels() < 2 || p.getChannel(1) == std::vector<float>({8388607.0f / 8388608.0f, -0.5f}));
+}
+
+
+// 6 channels are written as WAVE_FORMAT_EXTENSIBLE with their speaker mask
+static void testExtensibleHeader() {
+    AudioProcessor::WavHeader header = {};
+    header.audioFormat = WAVE_FORMAT_PCM;
+    header.numChannels = 6;
+    header.sampleRate = 48000;
+    header.bitsPerSample = 24;
+    header.blockAlign = 18;
+    header.byteRate = 48000 * 18;
+    header.channelMask = 0x3F;
+
+    std::stringstream file;
+    AudioProcessor::writeWavHeader(file, header, 18 * 100);
+
+    AudioProcessor::WavHeader read;
+    std::vector<char> listData;
+    CHECK(AudioProcessor::readWavHeader(file, read, listData) == 18 * 100);
+    CHECK(read.audioFormat == WAVE_FORMAT_PCM && read.subchunk1Size == 40);
+    CHECK(read.numChannels == 6 && read.bitsPerSample == 24 && read.channelMask == 0x3F);
+}
+
+
+// Channel letters and words, and channel numbers from 0 separated by commas
+static void testParseChannelMask() {
+    const std::pair<std::string, ChannelMask> valid[] = {
+        {"l", LEFT_CHANNEL}, {"R", RIGHT_CHANNEL}, {"b", ALL_CHANNELS}, {"Left", LEFT_CHANNEL},
+        {"right", RIGHT_CHANNEL}, {"BOTH", ALL_CHANNELS},
+        {"0", 1}, {"1", 2}, {"0,2", 5}, {"2,0,2", 5}, {"63", ChannelMask(1) << 63},
+    };
+    for (const auto& [text, expected] : valid) {
+        ChannelMask mask = 0;
+        CHECK(parseChannelMask(text, mask));
+        CHECK(mask == expected);
+    }
+
+    for (const char* text : {"", "64", "0,", ",1", "1,,2", "x", "-1", "1a", "0 1", "bogus", "rubbish", "lr"}) {
+        ChannelMask mask;
+        bool parsed;
+        {
+            Silence quiet(std::cerr);
+            parsed = parseChannelMask(text, mask);
+        }
+        CHECK(!parsed);
+    }
+}
+
+
+// Random chains write byte for byte the same .wav and .txt files in both modes, on 1 to 3
+// channels
+static void testDeferredMatchesImmediate() {
+    const std::string input = tempPath("audio_test_input.wav");
+    const std::string immediateOutput = tempPath("audio_test_immediate");
+    const std::string deferredOutput = tempPath("audio_test_deferred");
+    std::mt19937 rng(4);
+    Silence quiet(std::cout);
+
+    for (uint16_t numChannels : {1, 2, 3}) {
+        writeNoiseFile(input, 8000, numChannels, 20011, rng);
+
+        for (int script = 0; script < 40; script++) {
+            AudioProcessor immediate, deferred;
+            immediate.load(input);
+            deferred.load(input);
+
+            int length = 1 + rng() % 8;
+            for (int k = 0; k < length; k++) {
+                runRandomCommand(immediate, deferred, rng);
+                CHECK(immediate.getDuration() == deferred.getDuration());
+            }
+
+            immediate.writeOutputTxt(immediateOutput + ".txt");
+            deferred.writeOutputTxt(deferredOutput + ".txt");
+            immediate.save(immediateOutput + ".wav");
+            deferred.save(deferredOutput + ".wav");
+            CHECK(readFile(immediateOutput + ".txt") == readFile(deferredOutput + ".txt"));
+            CHECK(readFile(immediateOutput + ".wav") == readFile(deferredOutput + ".wav"));
+        }
+    }
+
+    for (const std::string& path : {input, immediateOutput + ".txt", deferredOutput + ".txt",
+                                     immediateOutput + ".wav", deferredOutput + ".wav"}) {
+        std::remove(path.c_str());
+    }
+}
+
+
+// Trim and reverse only move the view until most of the storage is trimmed away, and gains
+// land on the stored samples under the view
+static void testTrimReverseView() {
+    const std::string input = tempPath("audio_test_view.wav");
+    std::mt19937 rng(5);
+    Silence quiet(std::cout);
+
+    for (uint16_t numChannels : {1, 2, 3}) {
+        writeNoiseFile(input, 8000, numChannels, 40000, rng);
+        AudioProcessor original(input);
+        const std::vector<std::vector<float>>& originalChannels = original.getChannels();
+
+        // Frames [8000, 32000) backwards, still stored in place
+        AudioProcessor p(input);
+        p.trimAudio(1.0f, 4.0f);
+        reverseAudio(p);
+        CHECK(p.getChannel(0).size() == 40000);
+        CHECK(p.getDuration() == 3.0f);
+
+        volumeGain(p, 2.0f, ALL_CHANNELS, 0.0f, 0.5f);
+        p.evaluate();
+        CHECK(p.getNumChannels() == numChannels);
+        for (size_t c = 0; c < p.getNumChannels(); c++) {
+            CHECK(p.getChannel(c).size() == 24000);
+            for (size_t i = 0; i < 24000 && i < p.getChannel(c).size(); i++) {
+                float expected = originalChannels[c][31999 - i] * (i < 4000 ? 2.0f : 1.0f);
+                CHECK(p.getChannel(c)[i] == expected);
+            }
+        }
+
+        // Keeping under a quarter of the storage compacts it, frames [27999, 24000) backwards
+        AudioProcessor q(input);
+        q.trimAudio(1.0f, 4.0f);
+        reverseAudio(q);
+        q.trimAudio(0.5f, 1.0f);
+        CHECK(q.getNumChannels() == numChannels);
+        for (size_t c = 0; c < q.getNumChannels(); c++) {
+            CHECK(q.getChannel(c).size() == 4000);
+            for (size_t i = 0; i < 4000 && i < q.getChannel(c).size(); i++) {
+                CHECK(q.getChannel(c)[i] == originalChannels[c][27999 - i]);
+            }
+        }
+    }
+
+    std::remove(input.c_str());
+}
+
+
+// The text and CSV dumps of 1 to 3 channels, formatted in parallel chunks, match one line per
+// frame built with std::to_string. 44.1kHz does not divide a microsecond, so the time column carries a remainder.
+static void testTextDump() {
+    const std::string input = tempPath("audio_test_dump.wav");
+    const std::string output = tempPath("audio_test_dump");
+    const uint32_t sampleRate = 44100;
+    const size_t frames = 100003;
+    std::mt19937 rng(6);
+    Silence quiet(std::cout);
+    ThreadPool::setGlobalThreads(4);
+
+    for (uint16_t numChannels : {1, 2, 3}) {
+        writeNoiseFile(input, sampleRate, numChannels, frames, rng);
+        AudioProcessor p(input);
+
+        std::vector<std::vector<int16_t>> samples(numChannels, std::vector<int16_t>(frames));
+        for (size_t c = 0; c < numChannels; c++) {
+            AudioProcessor::floatToPcm16(p.getChannel(c).data(), samples[c].data(), frames);
+        }
+
+        const char* headers[] = {"", "time,sample\n", "time,left,right\n", "time,ch0,ch1,ch2\n"};
+        std::string text, csv = headers[numChannels];
+        char line[64];
+        for (size_t i = 0; i < frames; i++) {
+            uint64_t micros = static_cast<uint64_t>(i) * 1000000 / sampleRate;
+            std::snprintf(line, sizeof(line), "%" PRIu64 ".%06" PRIu64 ",", micros / 1000000, micros % 1000000);
+            csv += line;
+            for (size_t c = 0; c < numChannels; c++) {
+                std::string value = std::to_string(samples[c][i]);
+                text += (c ? " " : "") + value;
+                csv += (c ? "," : "") + value;
+            }
+            text += '\n';
+            csv += '\n';
+        }
+
+        p.writeOutputTxt(output + ".txt");
+        p.writeOutputTxt(output + ".csv", true);
+        CHECK(readFile(output + ".txt") == text);
+        CHECK(readFile(output + ".csv") == csv);
+    }
+
+    ThreadPool::setGlobalThreads(1);
+    for (const std::string& path : {input, output + ".txt", output + ".csv"}) {
+        std::remove(path.c_str());
+    }
+}
+
+
+// Samples that saturate are counted once when the audio is saved, never by the text dump
+static void testClipCounting() {
+    const std::string input = tempPath("audio_test_clip.wav");
+    const std::string output = tempPath("audio_test_clip");
+    std::mt19937 rng(8);
+    Silence quiet(std::cout);
+
+    writeNoiseFile(input, 8000, 2, 10000, rng);
+    AudioProcessor p(input);
+    volumeGain(p, 4.0f, ALL_CHANNELS, 0.0f, p.getDuration());
+    size_t expected = 0;
+    for (const std::vector<float>& channel : p.getChannels()) {
+        for (float sample : channel) {
+            expected += sample >= 1.0f || sample < -1.0f;
+        }
+    }
+    CHECK(expected > 0);
+
+    size_t before = AudioProcessor::getClippedSamples();
+    p.writeOutputTxt(output + ".txt");
+    CHECK(AudioProcessor::getClippedSamples() == before);
+    p.save(output + ".wav");
+    CHECK(AudioProcessor::getClippedSamples() == before + expected);
+
+    for (const std::string& path : {input, output + ".txt", output + ".wav"}) {
+        std::remove(path.c_str());
+    }
+}
+
+
+int main() {
+    RUN_TEST(testRf64Header);
+    RUN_TEST(testBadBlockAlign);
+    RUN_TEST(testChunkScan);
+    RUN_TEST(testExtensibleFormat);
+    RUN_TEST(testExtensibleHeader);
+    RUN_TEST(testParseChannelMask);
+    RUN_TEST(testDeferredMatchesImmediate);
+    RUN_TEST(testTrimReverseView);
+    RUN_TEST(testTextDump);
+    RUN_TEST(testClipCounting);
+    return testResult();
+}
@@ -0,0 +1,39 @@
+// Minimal checks for the unit tests, each test binary returns non-zero if any check failed
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+inline int checkFailures = 0;
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            checkFailures++;                                                                \
+        }                                                                                   \
+    } while (0)
+
+// Runs one test function and reports it
+#define RUN_TEST(test)                                                                      \
+    do {                                                                                    \
+        int before = checkFailures;                                                         \
+        test();                                                                             \
+        std::cout << (checkFailures == before ? "ok      " : "FAILED  ") << #test << "\n";  \
+    } while (0)
+
+// Path in the temporary directory that no other running test uses
+inline std::string tempPath(const std::string& name) {
+    return std::filesystem::temp_directory_path() / (std::to_string(getpid()) + "_" + name);
+}
+
+inline int testResult() {
+    return checkFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,225 @@
+// Zero-phase filtering split across threads against the serial pass, the FFT equaliser
+// engine against the IIR engine, partitioned convolution against direct convolution, and
+// the impulse response spectrum cache
+//
+// Usage: filter_test
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "../dsp.h"
+#include "../pool.h"
+#include "check.h"
+
+
+struct TransferFunction {
+    std::vector<double> b, a;
+};
+
+
+// Biquads from the Audio EQ Cookbook with a Q of 1/sqrt(2), normalised so a[0] == 1. Their zeros
+// are distinct, which tf2sos needs.
+static TransferFunction bandPass(double frequency, double sampleRate) {
+    double w = 2.0 * M_PI * frequency / sampleRate;
+    double alpha = std::sin(w) / (2.0 * M_SQRT1_2);
+    double a0 = 1.0 + alpha;
+    return {{alpha / a0, 0.0, -alpha / a0}, {1.0, -2.0 * std::cos(w) / a0, (1.0 - alpha) / a0}};
+}
+
+static TransferFunction peaking(double frequency, double gain_dB, double sampleRate) {
+    double w = 2.0 * M_PI * frequency / sampleRate;
+    double alpha = std::sin(w) / (2.0 * M_SQRT1_2);
+    double A = std::pow(10.0, gain_dB / 40.0);
+    double a0 = 1.0 + alpha / A;
+    return {{(1.0 + alpha * A) / a0, -2.0 * std::cos(w) / a0, (1.0 - alpha * A) / a0},
+            {1.0, -2.0 * std::cos(w) / a0, (1.0 - alpha / A) / a0}};
+}
+
+// Cascade of two filters
+static TransferFunction operator*(const TransferFunction& x, const TransferFunction& y) {
+    TransferFunction product = {std::vector<double>(x.b.size() + y.b.size() - 1), std::vector<double>(x.a.size() + y.a.size() - 1)};
+    for (size_t i = 0; i < x.b.size(); i++) {
+        for (size_t j = 0; j < y.b.size(); j++) product.b[i + j] += x.b[i] * y.b[j];
+    }
+    for (size_t i = 0; i < x.a.size(); i++) {
+        for (size_t j = 0; j < y.a.size(); j++) product.a[i + j] += x.a[i] * y.a[j];
+    }
+    return product;
+}
+
+
+static std::vector<float> noise(size_t n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> level(-0.5f, 0.5f);
+    std::vector<float> samples(n);
+    for (float& x : samples) x = level(rng);
+    return samples;
+}
+
+
+// Long channels are split into one segment per thread, each started from an estimated state
+static void testSegmentedFiltfilt() {
+    const size_t n = 1 << 20;
+    const std::vector<float> input = noise(n, 4);
+    const TransferFunction filters[] = {
+        bandPass(100.0, 44100.0),
+        bandPass(3000.0, 44100.0) * peaking(8000.0, 6.0, 44100.0),
+        peaking(500.0, -12.0, 44100.0),
+    };
+
+    ScratchArena scratch;
+    for (const TransferFunction& filter : filters) {
+        for (size_t numChannels = 1; numChannels <= 2; numChannels++) {
+            std::vector<std::vector<float>> serial(numChannels, input), segmented(numChannels, input);
+            std::vector<float*> serialChannels, segmentedChannels;
+            for (size_t c = 0; c < numChannels; c++) {
+                serialChannels.push_back(serial[c].data());
+                segmentedChannels.push_back(segmented[c].data());
+            }
+
+            ThreadPool::setGlobalThreads(1);
+            filtfiltChannels(serialChannels, n, filter.b, filter.a, scratch);
+            ThreadPool::setGlobalThreads(4);
+            filtfiltChannels(segmentedChannels, n, filter.b, filter.a, scratch);
+
+            for (size_t c = 0; c < numChannels; c++) {
+                float peak = 0.0f, difference = 0.0f;
+                for (size_t i = 0; i < n; i++) {
+                    peak = std::max(peak, std::abs(serial[c][i]));
+                    difference = std::max(difference, std::abs(serial[c][i] - segmented[c][i]));
+                }
+                CHECK(peak > 0.0f);
+                CHECK(difference <= 1e-6f * peak);
+            }
+        }
+    }
+    ThreadPool::setGlobalThreads(1);
+}
+
+
+// Largest difference between x and y relative to the peak of x, over [first, last)
+static float relativeDifference(const std::vector<float>& x, const std::vector<float>& y, size_t first, size_t last) {
+    float peak = 0.0f, difference = 0.0f;
+    for (size_t i = first; i < last; i++) {
+        peak = std::max(peak, std::abs(x[i]));
+        difference = std::max(difference, std::abs(x[i] - y[i]));
+    }
+    return difference / peak;
+}
+
+
+// Both engines apply the same zero-phase response, so away from the ends, where each starts
+// up its own way, they differ only by rounding
+static void testFftEqualiserMatchesIir() {
+    const uint32_t sampleRate = 44100;
+    const size_t n = 4 * sampleRate;
+    const std::vector<float> input = noise(n, 5);
+    const std::vector<float> gains = {1.0f, 2.0f, 0.5f, 1.5f, 3.0f};
+    const auto& bands = designBands(EQUALISER_LAYOUT, sampleRate);
+
+    ScratchArena scratch;
+    std::vector<float> iir(input), fft(input);
+    equaliseChannels({iir.data()}, n, bands, gains, EqEngine::IIR, scratch);
+    equaliseChannels({fft.data()}, n, bands, gains, EqEngine::FFT, scratch);
+
+    const size_t edge = sampleRate / 2;
+    CHECK(relativeDifference(iir, fft, edge, n - edge) < 1e-6f);
+}
+
+
+// Blocks are spread over the pool without overlapping writes, so threads do not change the result
+static void testFftEqualiserThreads() {
+    const uint32_t sampleRate = 44100;
+    const size_t n = 4 * sampleRate;
+    const std::vector<float> input = noise(n, 6);
+    const std::vector<float> gains = {2.0f, 1.0f, 1.0f, 0.5f, 1.0f};
+    const auto& bands = designBands(EQUALISER_LAYOUT, sampleRate);
+
+    ScratchArena scratch;
+    std::vector<float> serial(input), threaded(input);
+    ThreadPool::setGlobalThreads(1);
+    equaliseChannels({serial.data()}, n, bands, gains, EqEngine::FFT, scratch);
+    ThreadPool::setGlobalThreads(4);
+    equaliseChannels({threaded.data()}, n, bands, gains, EqEngine::FFT, scratch);
+    ThreadPool::setGlobalThreads(1);
+
+    CHECK(serial == threaded);
+}
+
+
+// Direct convolution in double precision, cut to the length of the input
+static std::vector<double> directConvolution(const std::vector<float>& input, const std::vector<float>& taps) {
+    std::vector<double> output(input.size(), 0.0);
+    for (size_t i = 0; i < input.size(); i++) {
+        for (size_t j = 0; j < taps.size() && j <= i; j++) {
+            output[i] += static_cast<double>(taps[j]) * input[i - j];
+        }
+    }
+    return output;
+}
+
+
+// Blocks of every size, the last one short, and responses shorter and longer than a block
+static void testConvolverMatchesDirect() {
+    const std::vector<float> input = noise(20000, 7);
+
+    for (size_t numTaps : {1, 2, 7, 100, 1000, 10000}) {
+        const std::vector<float> taps = noise(numTaps, numTaps);
+        const std::vector<double> reference = directConvolution(input, taps);
+        double peak = 0.0;
+        for (double x : reference) peak = std::max(peak, std::abs(x));
+
+        for (size_t blockSize : {2, 16, 256, 4096}) {
+            Convolver convolver(std::make_shared<const IrSpectrum>(taps, blockSize));
+            std::vector<float> output(input);
+            for (size_t i = 0; i < output.size(); i += blockSize) {
+                convolver.process(output.data() + i, output.data() + i, std::min(blockSize, output.size() - i));
+            }
+
+            double difference = 0.0;
+            for (size_t i = 0; i < output.size(); i++) {
+                difference = std::max(difference, std::abs(output[i] - reference[i]));
+            }
+            CHECK(difference <= 1e-6 * peak);
+        }
+    }
+}
+
+
+// Spectra are shared while the same taps and block size come back, and dropped once
+// CACHE_ENTRIES others have been used since
+static void testSpectrumCache() {
+    const std::vector<float> taps = noise(1000, 11);
+    std::shared_ptr<const IrSpectrum> first = IrSpectrum::get(taps, 256);
+    CHECK(IrSpectrum::get(taps, 256) == first);
+    CHECK(IrSpectrum::get(std::vector<float>(taps), 256) == first);
+    CHECK(IrSpectrum::get(taps, 512) != first);
+
+    std::vector<float> changed(taps);
+    changed[500] += 1.0f;
+    CHECK(IrSpectrum::get(changed, 256) != first);
+    changed.pop_back();
+    CHECK(IrSpectrum::get(changed, 256) != first);
+
+    // Each use makes it the most recent again
+    CHECK(IrSpectrum::get(taps, 256) == first);
+    for (size_t k = 0; k < IrSpectrum::CACHE_ENTRIES - 1; k++) {
+        IrSpectrum::get(noise(100, 20 + k), 256);
+    }
+    CHECK(IrSpectrum::get(taps, 256) == first);
+    for (size_t k = 0; k < IrSpectrum::CACHE_ENTRIES; k++) {
+        IrSpectrum::get(noise(100, 30 + k), 256);
+    }
+    CHECK(IrSpectrum::get(taps, 256) != first);
+}
+
+
+int main() {
+    RUN_TEST(testSegmentedFiltfilt);
+    RUN_TEST(testFftEqualiserMatchesIir);
+    RUN_TEST(testFftEqualiserThreads);
+    RUN_TEST(testConvolverMatchesDirect);
+    RUN_TEST(testSpectrumCache);
+    return testResult();
+}
@@ -0,0 +1,230 @@
+// Round trips of every sample format through its codec and through whole files, and the
+// 16-bit SIMD kernels against the scalar loops
+//
+// Usage: pcm_test
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#include "../audio.h"
+#include "check.h"
+
+
+struct Format {
+    uint16_t audioFormat;
+    uint16_t bitsPerSample;
+};
+
+static const Format FORMATS[] = {
+    {WAVE_FORMAT_PCM, 8}, {WAVE_FORMAT_PCM, 16}, {WAVE_FORMAT_PCM, 24}, {WAVE_FORMAT_PCM, 32}, {WAVE_FORMAT_IEEE_FLOAT, 32},
+};
+
+static const size_t FRAME_COUNTS[] = {0, 1, 7, 8, 9, 15, 16, 17, 33, 1000};
+
+
+// File samples that survive conversion to float and back: any 8, 16 and 24-bit value, 32-bit
+// values with 24 significant bits, and floats in [-1, 1)
+static std::vector<char> randomSamples(const PcmCodec& codec, size_t n, std::mt19937& rng) {
+    std::vector<char> bytes(n * codec.bytes);
+    for (size_t i = 0; i < n; i++) {
+        char* sample = bytes.data() + i * codec.bytes;
+        if (codec.audioFormat == WAVE_FORMAT_IEEE_FLOAT) {
+            float x = std::uniform_real_distribution<float>(-1.0f, 1.0f)(rng);
+            std::memcpy(sample, &x, sizeof(x));
+        } else if (codec.bitsPerSample == 32) {
+            int32_t x = static_cast<int32_t>(rng()) & ~0xFF;
+            std::memcpy(sample, &x, sizeof(x));
+        } else {
+            uint32_t x = rng();
+            std::memcpy(sample, &x, codec.bytes);
+        }
+    }
+    return bytes;
+}
+
+
+static void testCodecRoundTrip() {
+    std::mt19937 rng(1);
+
+    for (const Format& format : FORMATS) {
+        const PcmCodec* codec = findPcmCodec(format.audioFormat, format.bitsPerSample);
+        CHECK(codec);
+        if (!codec) continue;
+
+        for (size_t numChannels = 1; numChannels <= 3; numChannels++) {
+            for (size_t frames : FRAME_COUNTS) {
+                std::vector<char> bytes = randomSamples(*codec, frames * numChannels, rng);
+
+                // Interleaved
+                std::vector<float> samples(frames * numChannels);
+                std::vector<char> encoded(bytes.size());
+                codec->decode(bytes.data(), samples.data(), samples.size());
+                CHECK(codec->encode(samples.data(), encoded.data(), samples.size()) == 0);
+                CHECK(encoded == bytes);
+
+                // Planar
+                std::vector<std::vector<float>> channels(numChannels, std::vector<float>(frames));
+                float* outputs[3];
+                const float* inputs[3];
+                for (size_t c = 0; c < numChannels; c++) {
+                    outputs[c] = channels[c].data();
+                    inputs[c] = channels[c].data();
+                }
+                codec->deinterleave(bytes.data(), frames, numChannels, outputs);
+                for (size_t i = 0; i < frames * numChannels; i++) {
+                    CHECK(channels[i % numChannels][i / numChannels] == samples[i]);
+                }
+
+                std::fill(encoded.begin(), encoded.end(), 0);
+                CHECK(codec->interleave(inputs, frames, numChannels, encoded.data()) == 0);
+                CHECK(encoded == bytes);
+            }
+        }
+    }
+}
+
+
+static void testCodecScaling() {
+    const PcmCodec& pcm8 = *findPcmCodec(WAVE_FORMAT_PCM, 8);
+    const PcmCodec& pcm16 = *findPcmCodec(WAVE_FORMAT_PCM, 16);
+    const PcmCodec& pcm24 = *findPcmCodec(WAVE_FORMAT_PCM, 24);
+
+    // Full scale is the most negative value, unsigned 8-bit is centred on 128
+    const unsigned char bytes8[] = {0, 128, 255};
+    float samples[3];
+    pcm8.decode(reinterpret_cast<const char*>(bytes8), samples, 3);
+    CHECK(samples[0] == -1.0f && samples[1] == 0.0f && samples[2] == 127.0f / 128.0f);
+
+    const int16_t values16[] = {-32768, 0, 32767};
+    pcm16.decode(reinterpret_cast<const char*>(values16), samples, 3);
+    CHECK(samples[0] == -1.0f && samples[1] == 0.0f && samples[2] == 32767.0f / 32768.0f);
+
+    const unsigned char bytes24[] = {0x00, 0x00, 0x80, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F};
+    pcm24.decode(reinterpret_cast<const char*>(bytes24), samples, 3);
+    CHECK(samples[0] == -1.0f && samples[1] == -1.0f / 8388608.0f && samples[2] == 8388607.0f / 8388608.0f);
+
+    // Out of range samples saturate and are counted, halves round away from zero
+    const float loud[] = {1.5f, -1.5f, 0.25f, 1.5f / 32768.0f, -1.5f / 32768.0f};
+    int16_t encoded16[5];
+    CHECK(pcm16.encode(loud, reinterpret_cast<char*>(encoded16), 5) == 2);
+    CHECK(encoded16[0] == 32767 && encoded16[1] == -32768 && encoded16[2] == 8192);
+    CHECK(encoded16[3] == 2 && encoded16[4] == -2);
+
+    unsigned char encoded24[9];
+    CHECK(pcm24.encode(loud, reinterpret_cast<char*>(encoded24), 3) == 2);
+    CHECK(std::memcmp(encoded24, "\xFF\xFF\x7F\x00\x00\x80\x00\x00\x20", 9) == 0);
+}
+
+
+// Floats that hit the corner cases of the conversion: exact halves, just under a half,
+// saturation, both zeros
+static std::vector<float> awkwardFloats(size_t n, std::mt19937& rng) {
+    std::uniform_real_distribution<float> level(-1.2f, 1.2f);
+    std::vector<float> samples(n);
+    for (size_t i = 0; i < n; i++) {
+        float x = level(rng);
+        switch (i % 6) {
+            case 1: x = (std::round(x * 32768.0f) + 0.5f) / 32768.0f; break;
+            case 2: x = std::nextafter(0.5f / 32768.0f, 0.0f) * (x < 0.0f ? -1.0f : 1.0f); break;
+            case 3: x = i % 4 ? -0.0f : 0.0f; break;
+            case 4: x = x < 0.0f ? -1.0f : 32767.0f / 32768.0f; break;
+        }
+        samples[i] = x;
+    }
+    return samples;
+}
+
+
+static void testPcm16KernelsMatchScalar() {
+    const PcmCodec& codec = *findPcmCodec(WAVE_FORMAT_PCM, 16);
+    std::mt19937 rng(2);
+
+    for (size_t frames = 0; frames <= 1001; frames += frames < 40 ? 1 : 961) {
+        for (size_t numChannels = 1; numChannels <= 2; numChannels++) {
+            std::vector<std::vector<float>> channels;
+            const float* inputs[2];
+            for (size_t c = 0; c < numChannels; c++) {
+                channels.push_back(awkwardFloats(frames, rng));
+                inputs[c] = channels[c].data();
+            }
+
+            // Output one byte off alignment, as after an odd sized chunk
+            std::vector<char> scalar(frames * numChannels * 2 + 1), vector(scalar.size());
+            setPcmVectorKernels(false);
+            size_t scalarSaturated = codec.interleave(inputs, frames, numChannels, scalar.data() + 1);
+            setPcmVectorKernels(true);
+            size_t vectorSaturated = codec.interleave(inputs, frames, numChannels, vector.data() + 1);
+            CHECK(scalar == vector);
+            CHECK(scalarSaturated == vectorSaturated);
+
+            std::vector<float> scalarFloats(frames * numChannels), vectorFloats(frames * numChannels);
+            float* scalarOutputs[2] = {scalarFloats.data(), scalarFloats.data() + frames};
+            float* vectorOutputs[2] = {vectorFloats.data(), vectorFloats.data() + frames};
+            setPcmVectorKernels(false);
+            codec.deinterleave(scalar.data() + 1, frames, numChannels, scalarOutputs);
+            setPcmVectorKernels(true);
+            codec.deinterleave(scalar.data() + 1, frames, numChannels, vectorOutputs);
+            CHECK(scalarFloats == vectorFloats);
+        }
+    }
+}
+
+
+// Whole files through load and save, which are byte for byte the same when nothing ran
+static void testFileRoundTrip() {
+    const std::string path = tempPath("pcm_test_input.wav");
+    const std::string output = tempPath("pcm_test_output.wav");
+    std::mt19937 rng(3);
+
+    for (const Format& format : FORMATS) {
+        const PcmCodec& codec = *findPcmCodec(format.audioFormat, format.bitsPerSample);
+
+        for (uint16_t numChannels : {1, 2, 3}) {
+            AudioProcessor::WavHeader header = {};
+            header.audioFormat = format.audioFormat;
+            header.numChannels = numChannels;
+            header.sampleRate = 16000;
+            header.bitsPerSample = format.bitsPerSample;
+            header.blockAlign = numChannels * codec.bytes;
+            header.byteRate = header.sampleRate * header.blockAlign;
+
+            std::vector<char> samples = randomSamples(codec, 1001 * numChannels, rng);
+            {
+                std::ofstream file(path, std::ios::binary);
+                AudioProcessor::writeWavHeader(file, header, samples.size());
+                file.write(samples.data(), samples.size());
+                if (samples.size() % 2) file.put(0);
+            }
+
+            AudioProcessor audio;
+            audio.load(path);
+            audio.save(output);
+
+            std::ifstream in(path, std::ios::binary), out(output, std::ios::binary);
+            std::vector<char> written((std::istreambuf_iterator<char>(out)), std::istreambuf_iterator<char>());
+            std::vector<char> original((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            CHECK(written == original);
+
+            // The RIFF size covers the rest of the file, with the pad byte after odd sized data
+            uint32_t riffSize = 0;
+            std::memcpy(&riffSize, written.data() + 4, 4);
+            CHECK(written.size() % 2 == 0 && riffSize == written.size() - 8);
+        }
+    }
+
+    std::remove(path.c_str());
+    std::remove(output.c_str());
+}
+
+
+int main() {
+    RUN_TEST(testCodecRoundTrip);
+    RUN_TEST(testCodecScaling);
+    RUN_TEST(testPcm16KernelsMatchScalar);
+    RUN_TEST(testFileRoundTrip);
+    return testResult();
+}
@@ -0,0 +1,281 @@
+// Live parameter changes of raw PCM pipes and files streamed in blocks
+//
+// Usage: stream_test
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../stream.h"
+#include "check.h"
+
+
+// Deallocations made by threads that set countDeallocations
+static thread_local bool countDeallocations = false;
+static std::atomic<size_t> deallocations{0};
+
+
+void* operator new(size_t size) {
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+
+void operator delete(void* ptr) noexcept {
+    if (ptr && countDeallocations) {
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::free(ptr);
+}
+
+
+void operator delete(void* ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+
+// Reads exactly count bytes from a pipe, false if it ends first
+static bool readAll(int fd, char* data, size_t count) {
+    while (count) {
+        ssize_t n = read(fd, data, count);
+        if (n <= 0) return false;
+        data += n;
+        count -= n;
+    }
+    return true;
+}
+
+
+// A gain change ramps in from the start of a block over PARAM_RAMP_SECONDS, longer than a
+// block, and holds its target from the frame the ramp ends, which is within a block
+static void testPipeGainRamp() {
+    const uint32_t sampleRate = 44100;
+    const size_t blockSize = 256;
+    const size_t blocksAfter = 40;
+    const size_t rampFrames = std::max<size_t>(PARAM_RAMP_SECONDS * sampleRate, 1);
+    const std::string controlFile = tempPath("stream_test_control.txt");
+    std::ofstream(controlFile) << "g 0.5\n";
+
+    int input[2], output[2];
+    CHECK(pipe(input) == 0 && pipe(output) == 0);
+    std::FILE* in = fdopen(input[0], "rb");
+    std::FILE* out = fdopen(output[1], "wb");
+    CHECK(in && out);
+    if (!in || !out) return;
+
+    // Blocks go in one at a time until one comes out ramping, so the change always lands
+    // before the input ends however late the control thread reads it. The rest of the
+    // stream fits in the output pipe.
+    std::vector<int16_t> samples;
+    std::thread writer([&] {
+        std::vector<int16_t> block(blockSize, 16384);
+        auto writeBlock = [&] { return write(input[1], block.data(), block.size() * sizeof(int16_t)) >= 0; };
+
+        while (samples.size() < (1 << 24) && (samples.empty() || samples.back() == 16384) && writeBlock()) {
+            samples.resize(samples.size() + blockSize);
+            if (!readAll(output[0], reinterpret_cast<char*>(samples.data() + samples.size() - blockSize),
+                         blockSize * sizeof(int16_t))) break;
+        }
+        for (size_t k = 0; k < blocksAfter && writeBlock(); k++) {}
+        close(input[1]);
+    });
+
+    StreamProcessor stream(blockSize);
+    CHECK(stream.addChain({"g", "1"}));
+    CHECK(stream.processPipe(in, out, sampleRate, 1, controlFile));
+    writer.join();
+    std::fclose(in);
+    std::fclose(out);
+    std::remove(controlFile.c_str());
+
+    size_t rampStart = samples.size() - blockSize;
+    samples.resize(samples.size() + blocksAfter * blockSize);
+    CHECK(readAll(output[0], reinterpret_cast<char*>(samples.data() + rampStart + blockSize),
+                  blocksAfter * blockSize * sizeof(int16_t)));
+    close(output[0]);
+
+    for (size_t i = 0; i < rampStart; i++) {
+        CHECK(samples[i] == 16384);
+    }
+    for (size_t i = rampStart; i < rampStart + rampFrames; i++) {
+        CHECK(samples[i] < (i ? samples[i - 1] : 16384));
+    }
+    for (size_t i = rampStart + rampFrames - 1; i < samples.size(); i++) {
+        CHECK(samples[i] == 8192);
+    }
+}
+
+
+// Equaliser responses that live updates replace are freed on the control thread, so the
+// audio thread deallocates nothing from its first block to its last
+static void testPipeEqualiserFreesNothing() {
+    const uint32_t sampleRate = 44100;
+    const size_t blockSize = 256;
+    const int16_t level = 16384;
+    const std::string controlFile = tempPath("stream_test_control.fifo");
+    std::remove(controlFile.c_str());
+    CHECK(mkfifo(controlFile.c_str(), 0600) == 0);
+
+    int input[2], output[2];
+    CHECK(pipe(input) == 0 && pipe(output) == 0);
+    std::FILE* in = fdopen(input[0], "rb");
+    std::FILE* out = fdopen(output[1], "wb");
+    CHECK(in && out);
+    if (!in || !out) return;
+
+    // The audio thread waits for input between blocks, so the count is steady whenever a
+    // block has come out
+    size_t before = 0, after = 0;
+    std::thread writer([&] {
+        std::vector<int16_t> block(blockSize, level), result(blockSize);
+        auto step = [&] {
+            return write(input[1], block.data(), blockSize * sizeof(int16_t)) >= 0
+                && readAll(output[0], reinterpret_cast<char*>(result.data()), blockSize * sizeof(int16_t));
+        };
+        // Past the start of the response, so the output holds the level of a flat equaliser
+        for (size_t k = 0; k < 64 && step(); k++) {}
+        const int16_t flat = result.back();
+        before = deallocations.load();
+
+        // Most updates come two to a block, faster than the crossfades, so responses are
+        // dropped after the snapshots that held them were reused. Every sixth one settles.
+        std::ofstream control(controlFile);
+        for (int update = 0; update < 48; update++) {
+            float gain = update % 2 ? 0.25f : 0.5f;
+            control << "eq";
+            for (size_t band = 0; band < EQ_BANDS; band++) control << ' ' << gain;
+            control << std::endl;
+
+            // Time for the control thread to publish it
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            if (update % 6 != 5) {
+                if (update % 2) step();
+                continue;
+            }
+
+            int16_t target = flat * gain;
+            auto settled = [&] {
+                return std::all_of(result.begin(), result.end(), [&](int16_t x) { return std::abs(x - target) <= target / 32; });
+            };
+            size_t blocks = 0;
+            while (blocks++ < 1000 && step() && !settled()) {}
+            CHECK(settled());
+        }
+        control.close();
+
+        for (size_t k = 0; k < 4 && step(); k++) {}
+        after = deallocations.load();
+        close(input[1]);
+    });
+
+    StreamProcessor stream(blockSize);
+    CHECK(stream.addChain({"eq", "1", "1", "1", "1", "1"}));
+    countDeallocations = true;
+    CHECK(stream.processPipe(in, out, sampleRate, 1, controlFile));
+    countDeallocations = false;
+    writer.join();
+    std::fclose(in);
+    std::fclose(out);
+    close(output[0]);
+    std::remove(controlFile.c_str());
+
+    CHECK(after == before);
+}
+
+
+// A file shorter than its data chunk says streams the frames it has, the same as loading it,
+// and odd sized data is followed by a pad byte
+static void testTruncatedFile() {
+    const std::string input = tempPath("stream_test_truncated.wav");
+    const std::string streamed = tempPath("stream_test_streamed.wav");
+    const std::string loaded = tempPath("stream_test_loaded.wav");
+
+    for (uint16_t bitsPerSample : {8, 16}) {
+        AudioProcessor::WavHeader header = {};
+        header.audioFormat = WAVE_FORMAT_PCM;
+        header.numChannels = bitsPerSample == 8 ? 1 : 2;
+        header.sampleRate = 8000;
+        header.bitsPerSample = bitsPerSample;
+        header.blockAlign = header.numChannels * bitsPerSample / 8;
+        header.byteRate = header.sampleRate * header.blockAlign;
+
+        // 1000 frames in the header, 601 in the file and half of one more in stereo
+        std::string data(601 * header.blockAlign + header.blockAlign / 2, '\0');
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = static_cast<char>(i * 37);
+        }
+        {
+            std::ofstream file(input, std::ios::binary);
+            AudioProcessor::writeWavHeader(file, header, 1000 * header.blockAlign);
+            file.write(data.data(), data.size());
+        }
+
+        for (const std::vector<std::string>& command : {std::vector<std::string>{"g", "0.5"}, {"eq", "1", "2", "1", "1", "1"}}) {
+            StreamProcessor stream(256);
+            CHECK(stream.addChain(command));
+            stream.process(input, streamed);
+
+            AudioProcessor audio;
+            audio.load(input);
+            CHECK(audio.getChannel(0).size() == 601);
+            CHECK(stream.apply(audio));
+            audio.save(loaded);
+
+            std::ifstream a(streamed, std::ios::binary), b(loaded, std::ios::binary);
+            std::string output(std::istreambuf_iterator<char>(a), {});
+            CHECK(output == std::string(std::istreambuf_iterator<char>(b), {}));
+
+            uint32_t riffSize = 0;
+            std::memcpy(&riffSize, output.data() + 4, 4);
+            CHECK(output.size() % 2 == 0 && riffSize == output.size() - 8);
+        }
+    }
+
+    for (const std::string& path : {input, streamed, loaded}) {
+        std::remove(path.c_str());
+    }
+}
+
+
+// Every snapshot the consumer picks up is complete and newer than the last
+static void testTripleBuffer() {
+    const int last = 200000;
+    TripleBuffer<std::vector<int>> buffer(std::vector<int>(16, 0));
+
+    std::thread producer([&buffer] {
+        for (int value = 1; value <= last; value++) {
+            std::fill(buffer.back().begin(), buffer.back().end(), value);
+            buffer.publish();
+        }
+    });
+
+    int seen = 0;
+    while (seen < last) {
+        if (!buffer.update()) continue;
+        const std::vector<int>& front = buffer.front();
+        CHECK(std::all_of(front.begin(), front.end(), [&front](int x) { return x == front[0]; }));
+        CHECK(front[0] > seen);
+        seen = front[0];
+    }
+    producer.join();
+}
+
+
+int main() {
+    RUN_TEST(testPipeGainRamp);
+    RUN_TEST(testPipeEqualiserFreesNothing);
+    RUN_TEST(testTruncatedFile);
+    RUN_TEST(testTripleBuffer);
+    return testResult();
+}